@@ -10,8 +10,10 @@ struct IUnknown; // workaround for old Win SDK header failures when using /permi
 #include "Arena.h"
 #include "Colors.h"
 #include "Utils.h"
+#include "external/enkiTS/TaskScheduler.h"
 #include "external/flat_hash_map/bytell_hash_map.hpp"
 #include "external/inih/cpp/INIReader.h"
+#include "external/llvm-Demangle/include/Demangle.h"
 #include <algorithm>
 #include <assert.h>
 #include <string>
@@ -19,6 +21,17 @@ struct IUnknown; // workaround for old Win SDK header failures when using /permi
 #include <map>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ANALYSIS_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define ANALYSIS_NEON 1
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 struct Config
 {
     int fileParseCount = 10;
@@ -35,6 +48,68 @@ struct Config
     bool onlyRootHeaders = true;
 };
 
+// Columnar view of the events: analysis passes only look at events of some types,
+// and need just a few fields of them.
+struct EventColumns
+{
+    std::vector<uint8_t> type;
+    std::vector<int64_t> dur;
+    std::vector<DetailIndex> detail;
+    std::vector<EventIndex> parent;
+};
+
+static inline int CountTrailingZeros(uint32_t v)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, v);
+    return int(index);
+#else
+    return __builtin_ctz(v);
+#endif
+}
+
+// Indices of events that have one of two given types (can be the same), in order.
+static void SelectEvents(const EventColumns& columns, BuildEventType typeA, BuildEventType typeB, std::vector<EventIndex>& out)
+{
+    out.clear();
+    const uint8_t* types = columns.type.data();
+    const uint8_t a = uint8_t(typeA), b = uint8_t(typeB);
+    const size_t n = columns.type.size();
+    size_t i = 0;
+#if ANALYSIS_SSE2
+    // compare 16 types at a time, and only look at the matching ones
+    const __m128i va = _mm_set1_epi8((char)a);
+    const __m128i vb = _mm_set1_epi8((char)b);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i t = _mm_loadu_si128((const __m128i*)(types + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(t, va), _mm_cmpeq_epi8(t, vb)));
+        while (mask != 0)
+        {
+            out.emplace_back(int(i) + CountTrailingZeros(mask));
+            mask &= mask - 1;
+        }
+    }
+#elif ANALYSIS_NEON
+    // compare 16 types at a time, and skip the blocks without matches
+    const uint8x16_t va = vdupq_n_u8(a);
+    const uint8x16_t vb = vdupq_n_u8(b);
+    for (; i + 16 <= n; i += 16)
+    {
+        uint8x16_t t = vld1q_u8(types + i);
+        if (vmaxvq_u8(vorrq_u8(vceqq_u8(t, va), vceqq_u8(t, vb))) == 0)
+            continue;
+        for (size_t j = i; j != i + 16; ++j)
+            if (types[j] == a || types[j] == b)
+                out.emplace_back(int(j));
+    }
+#endif
+    for (; i < n; ++i)
+        if (types[i] == a || types[i] == b)
+            out.emplace_back(int(i));
+}
+
 struct pair_hash
 {
     template <class T1, class T2>
@@ -49,11 +124,33 @@ struct pair_hash
 
 struct Analysis
 {
-    Analysis(const BuildEvents& events_, BuildNames& buildNames_, FILE* out_)
-    : events(events_)
+    Analysis(enki::TaskScheduler& ts_, const BuildEvent* events, size_t eventsCount, BuildNames& buildNames_, FILE* out_)
+    : ts(ts_)
     , buildNames(buildNames_)
     , out(out_)
     {
+        const size_t n = eventsCount;
+        columns.type.resize(n);
+        columns.dur.resize(n);
+        columns.detail.resize(n);
+        columns.parent.resize(n);
+        for (size_t i = 0; i != n; ++i)
+        {
+            const BuildEvent& ev = events[i];
+            columns.type[i] = uint8_t(ev.type);
+            columns.dur[i] = ev.dur;
+            columns.detail[i] = ev.detailIndex;
+            columns.parent[i] = ev.parent;
+            largestDetailIndex = (std::max)(largestDetailIndex, ev.detailIndex.idx);
+        }
+
+        for (uint32_t i = 0; i < buildNames.tokensCount; ++i)
+        {
+            if (buildNames.Token(i) == "<")
+                openAngleToken = int(i);
+            if (buildNames.Token(i) == ">")
+                closeAngleToken = int(i);
+        }
         functions.reserve(256);
         instantiations.reserve(256);
         parseFiles.reserve(64);
@@ -61,7 +158,8 @@ struct Analysis
         headerMap.reserve(256);
     }
 
-    const BuildEvents& events;
+    enki::TaskScheduler& ts;
+    EventColumns columns;
     BuildNames& buildNames;
 
     FILE* out;
@@ -73,13 +171,24 @@ struct Analysis
 
         return buildNames[index];
     }
+    bool IsHeader(DetailIndex index) const
+    {
+        // only looks at the file name, so does not need the full path
+        return utils::IsHeader(buildNames.GetFilename(index));
+    }
+    bool NameLess(DetailIndex a, DetailIndex b) const
+    {
+        return buildNames.Compare(a, b) < 0;
+    }
+    int openAngleToken = -1;
+    int closeAngleToken = -1;
 
-    void ProcessEvent(EventIndex eventIndex);
+    void ProcessEvents();
     int largestDetailIndex = 0;
     void EndAnalysis();
 
     void FindExpensiveHeaders();
-    void ReadConfig();
+    void ReadConfig(const std::string& configFile);
 
     DetailIndex FindPath(EventIndex eventIndex) const;
 
@@ -109,6 +218,9 @@ struct Analysis
 
     ska::bytell_hash_map<DetailIndex, std::string_view> collapsedNames;
     std::string_view GetCollapsedName(DetailIndex idx);
+    ska::bytell_hash_map<DetailIndex, std::string_view> collapsedFunctionNames;
+    std::string_view GetCollapsedFunctionName(DetailIndex idx);
+    std::string_view CollapseTokens(DetailIndex idx);
     void EmitCollapsedTemplates();
     void EmitCollapsedTemplateOpt();
     void EmitCollapsedInfo(
@@ -118,15 +230,20 @@ struct Analysis
     // key is (name,objfile), value is milliseconds
     typedef std::pair<DetailIndex, DetailIndex> IndexPair;
     ska::bytell_hash_map<IndexPair, int64_t, pair_hash> functions;
+    // function names are stored mangled; demangled ones for each name index
+    std::vector<std::string_view> demangledNames;
+    void DemangleFunctionNames();
+    std::string_view GetFunctionName(DetailIndex index) const { return demangledNames[index.idx]; }
     ska::bytell_hash_map<EventIndex, InstantiateEntry> instantiations;
     std::vector<FileEntry> parseFiles;
     std::vector<FileEntry> codegenFiles;
     int64_t totalParseUs = 0;
     int64_t totalCodegenUs = 0;
+    int64_t totalPrunedUs = 0;
     int totalParseCount = 0;
 
-    ska::bytell_hash_map<std::string_view, IncludeEntry> headerMap;
-    std::vector<std::pair<std::string_view, int64_t>> expensiveHeaders;
+    ska::bytell_hash_map<DetailIndex, IncludeEntry> headerMap;
+    std::vector<std::pair<DetailIndex, int64_t>> expensiveHeaders;
 
     Config config;
 };
@@ -135,87 +252,102 @@ DetailIndex Analysis::FindPath(EventIndex eventIndex) const
 {
     while(eventIndex > EventIndex())
     {
-        const BuildEvent& ev = events[eventIndex];
-        if (ev.type == BuildEventType::kCompiler || ev.type == BuildEventType::kFrontend || ev.type == BuildEventType::kBackend || ev.type == BuildEventType::kOptModule)
-            if (ev.detailIndex != DetailIndex())
-                return ev.detailIndex;
-        eventIndex = ev.parent;
+        BuildEventType type = BuildEventType(columns.type[eventIndex.idx]);
+        DetailIndex detail = columns.detail[eventIndex.idx];
+        if (type == BuildEventType::kCompiler || type == BuildEventType::kFrontend || type == BuildEventType::kBackend || type == BuildEventType::kOptModule)
+            if (detail != DetailIndex())
+                return detail;
+        eventIndex = columns.parent[eventIndex.idx];
     }
     return DetailIndex();
 }
 
-void Analysis::ProcessEvent(EventIndex eventIndex)
+// Each kind of report only needs events of one or two types; select those first, and
+// aggregate them in separate passes. kOther events (time of pruned events) are not in any
+// per-name report; their time is in the durations of their parents, and in the summary.
+void Analysis::ProcessEvents()
 {
-    const BuildEvent& event = events[eventIndex];
-    largestDetailIndex = (std::max)(largestDetailIndex, event.detailIndex.idx);
+    std::vector<EventIndex> selected;
+    selected.reserve(columns.type.size() / 4);
 
-    if (event.type == BuildEventType::kOptFunction)
+    SelectEvents(columns, BuildEventType::kOptFunction, BuildEventType::kOptFunction, selected);
+    for (EventIndex i : selected)
     {
-        auto funKey = std::make_pair(event.detailIndex, FindPath(eventIndex));
-        functions[funKey] += event.dur;
+        auto funKey = std::make_pair(columns.detail[i.idx], FindPath(i));
+        functions[funKey] += columns.dur[i.idx];
     }
 
-    if (event.type == BuildEventType::kInstantiateClass || event.type == BuildEventType::kInstantiateFunction)
+    SelectEvents(columns, BuildEventType::kInstantiateClass, BuildEventType::kInstantiateFunction, selected);
+    for (EventIndex i : selected)
     {
-        auto& e = instantiations[eventIndex];
+        auto& e = instantiations[i];
         ++e.count;
-        e.us += event.dur;
+        e.us += columns.dur[i.idx];
     }
 
-    if (event.type == BuildEventType::kFrontend)
+    SelectEvents(columns, BuildEventType::kFrontend, BuildEventType::kFrontend, selected);
+    for (EventIndex i : selected)
     {
-        totalParseUs += event.dur;
+        int64_t dur = columns.dur[i.idx];
+        totalParseUs += dur;
         ++totalParseCount;
-        if (event.dur >= config.minFileTime * 1000)
+        if (dur >= config.minFileTime * 1000)
         {
             FileEntry fe;
-            fe.file = FindPath(eventIndex);
-            fe.us = event.dur;
+            fe.file = FindPath(i);
+            fe.us = dur;
             parseFiles.emplace_back(fe);
         }
     }
-    if (event.type == BuildEventType::kBackend)
+
+    SelectEvents(columns, BuildEventType::kOther, BuildEventType::kOther, selected);
+    for (EventIndex i : selected)
+        totalPrunedUs += columns.dur[i.idx];
+
+    SelectEvents(columns, BuildEventType::kBackend, BuildEventType::kBackend, selected);
+    for (EventIndex i : selected)
     {
-        totalCodegenUs += event.dur;
-        if (event.dur >= config.minFileTime * 1000)
+        int64_t dur = columns.dur[i.idx];
+        totalCodegenUs += dur;
+        if (dur >= config.minFileTime * 1000)
         {
             FileEntry fe;
-            fe.file = FindPath(eventIndex);
-            fe.us = event.dur;
+            fe.file = FindPath(i);
+            fe.us = dur;
             codegenFiles.emplace_back(fe);
         }
     }
-    if (event.type == BuildEventType::kParseFile)
+
+    SelectEvents(columns, BuildEventType::kParseFile, BuildEventType::kParseFile, selected);
+    for (EventIndex i : selected)
     {
-        std::string_view path = GetBuildName(event.detailIndex);
-        if (utils::IsHeader(path))
-        {
-            IncludeEntry& e = headerMap[path];
-            e.us += event.dur;
-            ++e.count;
-
-            // record chain of ParseFile entries leading up to this one
-            IncludeChain chain;
-            chain.us = event.dur;
-            EventIndex parseIndex = event.parent;
-            bool hasHeaderBefore = false;
-            while(parseIndex.idx >= 0)
-            {
-                const BuildEvent& ev2 = events[parseIndex];
-                if (ev2.type != BuildEventType::kParseFile)
-                    break;
-                std::string_view ev2path = GetBuildName(ev2.detailIndex);
-                bool isHeader = utils::IsHeader(ev2path);
-                if (!isHeader)
-                    break;
-                chain.files.push_back(ev2.detailIndex);
-                hasHeaderBefore |= isHeader;
-                parseIndex = ev2.parent;
-            }
+        DetailIndex detail = columns.detail[i.idx];
+        if (!IsHeader(detail))
+            continue;
+        IncludeEntry& e = headerMap[detail];
+        e.us += columns.dur[i.idx];
+        ++e.count;
 
-            e.root |= !hasHeaderBefore;
-            e.includePaths.push_back(chain);
+        // record chain of ParseFile entries leading up to this one
+        IncludeChain chain;
+        chain.us = columns.dur[i.idx];
+        EventIndex parseIndex = columns.parent[i.idx];
+        bool hasHeaderBefore = false;
+        while(parseIndex.idx >= 0)
+        {
+            if (BuildEventType(columns.type[parseIndex.idx]) != BuildEventType::kParseFile)
+                break;
+            DetailIndex parentDetail = columns.detail[parseIndex.idx];
+            bool isHeader = IsHeader(parentDetail);
+            if (!isHeader)
+                break;
+            chain.files.push_back(parentDetail);
+            hasHeaderBefore |= isHeader;
+            parseIndex = columns.parent[parseIndex.idx];
         }
+
+        e.root |= !hasHeaderBefore;
+        e.includePaths.push_back(chain);
     }
 }
 
@@ -274,14 +406,138 @@ static std::string_view CollapseName(const std::string_view& elt)
     return std::string_view(ptr, size);
 }
 
+// Same as CollapseName, for a tokenized name: "<" and ">" are always tokens of their own,
+// so the full name does not need to be built.
+std::string_view Analysis::CollapseTokens(DetailIndex detail)
+{
+    const uint32_t* tokens = buildNames.TokensBegin(detail);
+    const size_t n = buildNames.TokensEnd(detail) - tokens;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (buildNames.Token(tokens[i]).find("operator") != std::string::npos)
+            return GetBuildName(detail);
+    }
+
+    std::string retval;
+    auto append = [&](size_t from, size_t to)
+    {
+        for (size_t i = from; i < to; ++i)
+            retval.append(buildNames.Token(tokens[i]));
+    };
+    size_t b_range = 0;
+    size_t e_range = 0;
+    while (b_range != n)
+    {
+        e_range = std::find(tokens + b_range, tokens + n, uint32_t(openAngleToken)) - tokens;
+        if (e_range == n)
+            break;
+        ++e_range;
+        append(b_range, e_range);
+        retval.append("$");
+        b_range = e_range;
+        int open_count = 1;
+        // find the matching close angle bracket
+        for (; b_range != n; ++b_range)
+        {
+            if (tokens[b_range] == uint32_t(openAngleToken))
+            {
+                ++open_count;
+                continue;
+            }
+            if (tokens[b_range] == uint32_t(closeAngleToken))
+            {
+                if (--open_count == 0)
+                {
+                    break;
+                }
+                continue;
+            }
+        }
+    }
+    if (b_range > e_range)
+        return GetBuildName(detail);
+    append(b_range, e_range);
+
+    size_t size = retval.size();
+    char* ptr = (char*)ArenaAllocate(size+1);
+    memcpy(ptr, retval.c_str(), size+1);
+    return std::string_view(ptr, size);
+}
+
 std::string_view Analysis::GetCollapsedName(DetailIndex detail)
 {
     std::string_view& name = collapsedNames[detail];
     if (name.empty())
-        name = CollapseName(GetBuildName(detail));
+        name = buildNames.IsTokenized(detail) ? CollapseTokens(detail) : CollapseName(GetBuildName(detail));
+    return name;
+}
+
+std::string_view Analysis::GetCollapsedFunctionName(DetailIndex detail)
+{
+    std::string_view& name = collapsedFunctionNames[detail];
+    if (name.empty())
+        name = CollapseName(GetFunctionName(detail));
     return name;
 }
 
+// Demangles all the function names, each unique name once, in parallel. Different mangled
+// names can demangle to the same thing (e.g. complete and base object constructors); the
+// function entries of those are merged into one.
+void Analysis::DemangleFunctionNames()
+{
+    std::vector<DetailIndex> mangled;
+    std::vector<bool> seen(buildNames.size());
+    for (const auto& fn : functions)
+    {
+        if (!seen[fn.first.first.idx])
+        {
+            seen[fn.first.first.idx] = true;
+            mangled.emplace_back(fn.first.first);
+        }
+    }
+    std::sort(mangled.begin(), mangled.end());
+
+    // full names are built lazily by BuildNames, so get them before going wide
+    std::vector<std::string_view> mangledNames(mangled.size());
+    for (size_t i = 0; i < mangled.size(); ++i)
+        mangledNames[i] = GetBuildName(mangled[i]);
+    std::vector<std::string> demangled(mangled.size());
+    enki::TaskSet task((uint32_t)mangled.size(), [&](enki::TaskSetPartition range, uint32_t) {
+        for (uint32_t i = range.start; i != range.end; ++i)
+            demangled[i] = llvm::demangle(std::string(mangledNames[i]));
+    });
+    ts.AddTaskSetToPipe(&task);
+    ts.WaitforTask(&task);
+
+    demangledNames.resize(buildNames.size());
+    ska::bytell_hash_map<std::string_view, DetailIndex> demangledToIndex;
+    ska::bytell_hash_map<DetailIndex, DetailIndex> remap;
+    for (size_t i = 0; i < mangled.size(); ++i)
+    {
+        const std::string& name = demangled[i];
+        char* ptr = (char*)ArenaAllocate(name.size()+1);
+        memcpy(ptr, name.c_str(), name.size()+1);
+        std::string_view view(ptr, name.size());
+        auto it = demangledToIndex.insert(std::make_pair(view, mangled[i])).first;
+        demangledNames[mangled[i].idx] = view;
+        if (it->second != mangled[i])
+            remap.insert(std::make_pair(mangled[i], it->second));
+    }
+    if (remap.empty())
+        return;
+    ska::bytell_hash_map<IndexPair, int64_t, pair_hash> merged;
+    merged.reserve(functions.size());
+    for (const auto& fn : functions)
+    {
+        IndexPair key = fn.first;
+        auto it = remap.find(key.first);
+        if (it != remap.end())
+            key.first = it->second;
+        merged[key] += fn.second;
+    }
+    functions.swap(merged);
+}
+
 void Analysis::EmitCollapsedInfo(
     const ska::bytell_hash_map<std::string_view, InstantiateEntry> &collapsed,
     const char *header_string)
@@ -313,24 +569,24 @@ void Analysis::EmitCollapsedTemplates()
     ska::bytell_hash_map<std::string_view, InstantiateEntry> collapsed;
     for (const auto& inst : instantiations)
     {
-        const std::string_view name = GetCollapsedName(events[inst.first].detailIndex);
+        const std::string_view name = GetCollapsedName(columns.detail[inst.first.idx]);
         auto &stats = collapsed[name];
 
         bool recursive = false;
-        EventIndex p = events[inst.first].parent;
+        EventIndex p = columns.parent[inst.first.idx];
         while (p != EventIndex(-1))
         {
-            auto &event = events[p];
-            if (event.type == BuildEventType::kInstantiateClass || event.type == BuildEventType::kInstantiateFunction)
+            BuildEventType type = BuildEventType(columns.type[p.idx]);
+            if (type == BuildEventType::kInstantiateClass || type == BuildEventType::kInstantiateFunction)
             {
-                const std::string_view ancestor_name = GetCollapsedName(event.detailIndex);
+                const std::string_view ancestor_name = GetCollapsedName(columns.detail[p.idx]);
                 if (ancestor_name == name)
                 {
                     recursive = true;
                     break;
                 }
             }
-            p = event.parent;
+            p = columns.parent[p.idx];
         }
         if (!recursive)
         {
@@ -347,12 +603,11 @@ void Analysis::EmitCollapsedTemplateOpt()
     for (const auto& fn : functions)
     {
         auto fnNameIndex = fn.first.first;
-        const std::string_view fnName = GetBuildName(fnNameIndex);
         // if we're not related to templates at all, skip
-        if (fnName.find('<') == std::string::npos)
+        if (GetFunctionName(fnNameIndex).find('<') == std::string::npos)
             continue;
 
-        auto &stats = collapsed[GetCollapsedName(fnNameIndex)];
+        auto &stats = collapsed[GetCollapsedFunctionName(fnNameIndex)];
         ++stats.count;
         stats.us += fn.second;
     }
@@ -367,6 +622,8 @@ void Analysis::EndAnalysis()
         fprintf(out, "Compilation (%i times):\n", totalParseCount);
         fprintf(out, "  Parsing (frontend):        %s%7.1f%s s\n", col::kBold, static_cast<double>(totalParseUs) / 1000000.0, col::kReset);
         fprintf(out, "  Codegen & opts (backend):  %s%7.1f%s s\n", col::kBold, static_cast<double>(totalCodegenUs) / 1000000.0, col::kReset);
+        if (totalPrunedUs)
+            fprintf(out, "  Pruned events (in above):  %s%7.1f%s s\n", col::kBold, static_cast<double>(totalPrunedUs) / 1000000.0, col::kReset);
         fprintf(out, "\n");
     }
 
@@ -381,7 +638,7 @@ void Analysis::EndAnalysis()
             const auto& b = parseFiles[indexB];
             if (a.us != b.us)
                 return a.us > b.us;
-            return GetBuildName(a.file) < GetBuildName(b.file);
+            return NameLess(a.file, b.file);
             });
         fprintf(out, "%s%s**** Files that took longest to parse (compiler frontend)%s:\n", col::kBold, col::kMagenta, col::kReset);
         for (size_t i = 0, n = std::min<size_t>(config.fileParseCount, indices.size()); i != n; ++i)
@@ -402,7 +659,7 @@ void Analysis::EndAnalysis()
             const auto& b = codegenFiles[indexB];
             if (a.us != b.us)
                 return a.us > b.us;
-            return GetBuildName(a.file) < GetBuildName(b.file);
+            return NameLess(a.file, b.file);
             });
         fprintf(out, "%s%s**** Files that took longest to codegen (compiler backend)%s:\n", col::kBold, col::kMagenta, col::kReset);
         for (size_t i = 0, n = std::min<size_t>(config.fileCodegenCount, indices.size()); i != n; ++i)
@@ -419,7 +676,7 @@ void Analysis::EndAnalysis()
         instArray.resize(largestDetailIndex+1);
         for (const auto& inst : instantiations) //collapse the events
         {
-            DetailIndex d = events[inst.first].detailIndex;
+            DetailIndex d = columns.detail[inst.first.idx];
             instArray[d.idx].first = d;
             instArray[d.idx].second.us += inst.second.us;
             instArray[d.idx].second.count += inst.second.count;
@@ -449,6 +706,7 @@ void Analysis::EndAnalysis()
 
     if (!functions.empty())
     {
+        DemangleFunctionNames();
         std::vector<std::pair<IndexPair, int64_t>> functionsArray;
         std::vector<int> indices;
         functionsArray.reserve(functions.size());
@@ -464,13 +722,13 @@ void Analysis::EndAnalysis()
             const auto& b = functionsArray[indexB];
             if (a.second != b.second)
                 return a.second > b.second;
-            return GetBuildName(a.first.first) < GetBuildName(b.first.first);
+            return GetFunctionName(a.first.first) < GetFunctionName(b.first.first);
             });
         fprintf(out, "%s%s**** Functions that took longest to compile%s:\n", col::kBold, col::kMagenta, col::kReset);
         for (size_t i = 0, n = std::min<size_t>(config.functionCount, indices.size()); i != n; ++i)
         {
             const auto& e = functionsArray[indices[i]];
-            std::string dname = std::string(GetBuildName(e.first.first));
+            std::string dname = std::string(GetFunctionName(e.first.first));
             if (static_cast<int>(dname.size()) > config.maxName)
                 dname = dname.substr(0, config.maxName-2) + "...";
             int ms = int(e.second / 1000);
@@ -490,7 +748,7 @@ void Analysis::EndAnalysis()
             const auto& es = headerMap[e.first];
             int ms = int(e.second / 1000);
             int avg = ms / es.count;
-            fprintf(out, "%s%i%s ms: %s%s%s (included %i times, avg %i ms), included via:\n", col::kBold, ms, col::kReset, col::kBold, e.first.data(), col::kReset, es.count, avg);
+            fprintf(out, "%s%i%s ms: %s%s%s (included %i times, avg %i ms), included via:\n", col::kBold, ms, col::kReset, col::kBold, GetBuildName(e.first).data(), col::kReset, es.count, avg);
             int pathCount = 0;
 
             // print most costly include chains
@@ -525,7 +783,7 @@ void Analysis::EndAnalysis()
                 fprintf(out, "  %ix: ", chain.count);
                 for (auto it = chain.files.rbegin(), itEnd = chain.files.rend(); it != itEnd; ++it)
                 {
-                    fprintf(out, "%s ", utils::GetFilename(GetBuildName(*it)).data());
+                    fprintf(out, "%s ", buildNames.GetFilename(*it).data());
                 }
                 if (chain.files.empty())
                     fprintf(out, "<direct include>");
@@ -557,15 +815,15 @@ void Analysis::FindExpensiveHeaders()
     {
         if (a.second != b.second)
             return a.second > b.second;
-        return a.first < b.first;
+        return NameLess(a.first, b.first);
     });
     if (static_cast<int>(expensiveHeaders.size()) > config.headerCount)
         expensiveHeaders.resize(config.headerCount);
 }
 
-void Analysis::ReadConfig()
+void Analysis::ReadConfig(const std::string& configFile)
 {
-    INIReader ini("ClangBuildAnalyzer.ini");
+    INIReader ini(configFile);
 
     config.fileParseCount   = (int)ini.GetInteger("counts", "fileParse",    config.fileParseCount);
     config.fileCodegenCount = (int)ini.GetInteger("counts", "fileCodegen",  config.fileCodegenCount);
@@ -581,11 +839,10 @@ void Analysis::ReadConfig()
 }
 
 
-void DoAnalysis(const BuildEvents& events, BuildNames& names, FILE* out)
+void DoAnalysis(enki::TaskScheduler& ts, const BuildEvent* events, size_t eventsCount, BuildNames& names, FILE* out, const std::string& configFile)
 {
-    Analysis a(events, names, out);
-    a.ReadConfig();
-    for (int i = 0, n = (int)events.size(); i != n; ++i)
-        a.ProcessEvent(EventIndex(i));
+    Analysis a(ts, events, eventsCount, names, out);
+    a.ReadConfig(configFile);
+    a.ProcessEvents();
     a.EndAnalysis();
 }
@@ -5,4 +5,6 @@
 #include "BuildEvents.h"
 #include <stdio.h>
 
-void DoAnalysis(const BuildEvents& events, BuildNames& names, FILE* out);
+namespace enki { class TaskScheduler; }
+
+void DoAnalysis(enki::TaskScheduler& ts, const BuildEvent* events, size_t eventsCount, BuildNames& names, FILE* out, const std::string& configFile);
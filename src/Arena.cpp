@@ -1,21 +1,100 @@
 // Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
 // SPDX-License-Identifier: Unlicense
 
+#include "Arena.h"
+
 #include <cstdint>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <vector>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Each thread allocates from its own chain of blocks, so allocations never need to lock.
+// Blocks grow geometrically; large blocks are backed by huge pages where the OS supports
+// that, so that walking through lots of names has fewer TLB misses.
+
 struct ArenaBlock
 {
     uint8_t* buffer;
     size_t bufferSize;
     size_t used;
+    bool mapped;
 };
 
-static std::vector<ArenaBlock> s_Blocks;
+struct ThreadArena
+{
+    std::vector<ArenaBlock> blocks;
+    size_t nextBlockSize;
+};
+
+const size_t kMinBlockSize = 65536;
+const size_t kMaxBlockSize = 64 * 1024 * 1024;
+const size_t kHugePageSize = 2 * 1024 * 1024;
+
+// all thread arenas, so that they can be released in one go
+static std::mutex s_ArenasMutex;
+static std::vector<ThreadArena*> s_Arenas;
+// bumped on ArenaDelete, so that threads know their arena is gone
+static std::atomic<uint32_t> s_Generation(1);
 
-const size_t kDefaultBlockSize = 65536;
+struct ThreadArenaRef
+{
+    ThreadArena* arena = nullptr;
+    uint32_t generation = 0;
+};
+static thread_local ThreadArenaRef t_Arena;
+
+
+static ArenaBlock AllocateBlock(size_t size)
+{
+    ArenaBlock block;
+    block.used = 0;
+    block.mapped = false;
+#if defined(__linux__)
+    if (size >= kHugePageSize)
+    {
+        // huge pages need 2MB aligned memory: map a bit more, and unmap the unaligned ends
+        size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+        size_t mapSize = size + kHugePageSize;
+        void* mem = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED)
+        {
+            uintptr_t start = (uintptr_t)mem;
+            uintptr_t aligned = (start + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+            if (aligned != start)
+                munmap(mem, aligned - start);
+            if (aligned + size != start + mapSize)
+                munmap((void*)(aligned + size), start + mapSize - aligned - size);
+#ifdef MADV_HUGEPAGE
+            madvise((void*)aligned, size, MADV_HUGEPAGE);
+#endif
+            block.buffer = (uint8_t*)aligned;
+            block.bufferSize = size;
+            block.mapped = true;
+            return block;
+        }
+    }
+#endif
+    block.buffer = new uint8_t[size];
+    block.bufferSize = size;
+    return block;
+}
 
+static void FreeBlock(ArenaBlock& block)
+{
+#if defined(__linux__)
+    if (block.mapped)
+    {
+        munmap(block.buffer, block.bufferSize);
+        return;
+    }
+#endif
+    delete[] block.buffer;
+}
 
 void ArenaInitialize()
 {
@@ -23,27 +102,42 @@ void ArenaInitialize()
 
 void ArenaDelete()
 {
-    for (auto& b : s_Blocks)
-        delete[] b.buffer;
-    s_Blocks.clear();
+    std::scoped_lock lock(s_ArenasMutex);
+    for (ThreadArena* arena : s_Arenas)
+    {
+        for (auto& b : arena->blocks)
+            FreeBlock(b);
+        delete arena;
+    }
+    s_Arenas.clear();
+    s_Generation++;
 }
 
 void* ArenaAllocate(size_t size)
 {
+    ThreadArenaRef& ref = t_Arena;
+    uint32_t generation = s_Generation.load(std::memory_order_relaxed);
+    if (ref.arena == nullptr || ref.generation != generation)
+    {
+        // first allocation on this thread (since the last ArenaDelete)
+        ref.arena = new ThreadArena();
+        ref.arena->nextBlockSize = kMinBlockSize;
+        ref.generation = generation;
+        std::scoped_lock lock(s_ArenasMutex);
+        s_Arenas.emplace_back(ref.arena);
+    }
+    ThreadArena& arena = *ref.arena;
+
     // do we need a new block?
-    if (s_Blocks.empty() || s_Blocks.back().used + size > s_Blocks.back().bufferSize)
+    if (arena.blocks.empty() || arena.blocks.back().used + size > arena.blocks.back().bufferSize)
     {
-        ArenaBlock block;
-        block.bufferSize = std::max(size, kDefaultBlockSize);
-        block.buffer = new uint8_t[block.bufferSize];
-        block.used = 0;
-        s_Blocks.emplace_back(block);
+        arena.blocks.emplace_back(AllocateBlock(std::max(size, arena.nextBlockSize)));
+        arena.nextBlockSize = std::min(arena.nextBlockSize * 2, kMaxBlockSize);
     }
-    
+
     // allocate from the last block
-    ArenaBlock& b = s_Blocks.back();
+    ArenaBlock& b = arena.blocks.back();
     void* ptr = b.buffer + b.used;
     b.used += size;
     return ptr;
 }
-
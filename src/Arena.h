@@ -1,7 +1,11 @@
 // Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
 // SPDX-License-Identifier: Unlicense
 #pragma once
+#include <stddef.h>
 
+// Memory that is only released all at once, in ArenaDelete.
 void ArenaInitialize();
+// NOTE: no thread can be allocating while this is called
 void ArenaDelete();
+// NOTE: can be called in parallel
 void* ArenaAllocate(size_t size);
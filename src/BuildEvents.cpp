@@ -10,14 +10,28 @@
 #include "Colors.h"
 #include "Utils.h"
 #include "external/cute_files.h"
+#include "external/enkiTS/TaskScheduler.h"
 #include "external/flat_hash_map/bytell_hash_map.hpp"
-#include "external/llvm-Demangle/include/Demangle.h"
 #include "external/simdjson/simdjson.h"
 #include "external/xxHash/xxhash.h"
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <cinttypes>
 #include <iterator>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 struct HashedString
 {
@@ -27,6 +41,12 @@ struct HashedString
         hash = XXH64(s, len, 0);
         str = s;
     }
+    explicit HashedString(std::string_view s)
+    {
+        len = s.size();
+        hash = XXH64(s.data(), len, 0);
+        str = s.data();
+    }
     size_t hash;
     size_t len;
     const char* str;
@@ -51,6 +71,212 @@ namespace std
 
 typedef ska::bytell_hash_map<HashedString, DetailIndex> NameToIndexMap;
 
+// Concurrent name interning table: parsing threads add names into it directly, and get
+// the final (global) name indices right away. The table is split into shards by name hash,
+// each with its own lock; indices are handed out from a shared counter, so they are dense,
+// and the names are stored by index in blocks that never move once allocated.
+struct NameTable
+{
+    NameTable()
+    : blocks(new std::atomic<std::string_view*>[kMaxBlocks])
+    {
+        for (size_t i = 0; i < kMaxBlocks; ++i)
+            blocks[i] = nullptr;
+    }
+    ~NameTable()
+    {
+        for (size_t i = 0; i < kMaxBlocks; ++i)
+            delete[] blocks[i].load();
+    }
+
+    // Each unique name is only stored once: it is copied into the arena the first time
+    // it is seen, unless it is there already (stable: lives until ArenaDelete, and
+    // is followed by a null terminator).
+    // NOTE: can be called in parallel
+    DetailIndex Intern(HashedString name, bool stable = false)
+    {
+        Shard& shard = shards[(name.hash >> 32) % kShardCount];
+        std::scoped_lock lock(shard.mutex);
+        auto it = shard.nameToIndex.find(name);
+        if (it != shard.nameToIndex.end())
+            return it->second;
+
+        if (!stable)
+        {
+            char* strCopy = (char*)ArenaAllocate(name.len+1);
+            memcpy(strCopy, name.str, name.len);
+            strCopy[name.len] = 0;
+            name.str = strCopy;
+        }
+
+        DetailIndex index(count++);
+        size_t block = size_t(index.idx) / kBlockSize;
+        assert(block < kMaxBlocks);
+        std::string_view* names = blocks[block].load(std::memory_order_acquire);
+        if (names == nullptr)
+        {
+            // whoever gets to publish the block first wins
+            std::string_view* newNames = new std::string_view[kBlockSize];
+            if (blocks[block].compare_exchange_strong(names, newNames, std::memory_order_acq_rel))
+                names = newNames;
+            else
+                delete[] newNames;
+        }
+        names[size_t(index.idx) % kBlockSize] = std::string_view(name.str, name.len);
+        shard.nameToIndex.insert(std::make_pair(name, index));
+        return index;
+    }
+
+    // NOTE: only valid once no more names are being added
+    size_t Size() const { return size_t(count.load()); }
+    std::string_view operator[](DetailIndex index) const
+    {
+        return blocks[size_t(index.idx) / kBlockSize].load(std::memory_order_relaxed)[size_t(index.idx) % kBlockSize];
+    }
+
+    enum { kShardCount = 64 };
+    static const size_t kBlockSize = 16384;
+    static const size_t kMaxBlocks = 131072; // 2^31 names
+
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        NameToIndexMap nameToIndex;
+    };
+    Shard shards[kShardCount];
+    std::atomic<int> count{ 0 };
+    std::unique_ptr<std::atomic<std::string_view*>[]> blocks;
+};
+
+// Concurrent cache of raw file paths (as they are in the trace files) to the indices of
+// their normalized names. The same few thousand headers show up in almost every trace file,
+// so most lookups are hits; shards are only locked for writing when adding a new path.
+struct PathCache
+{
+    // NOTE: can be called in parallel
+    bool Find(const HashedString& path, DetailIndex& outIndex)
+    {
+        Shard& shard = shards[(path.hash >> 32) % kShardCount];
+        std::shared_lock lock(shard.mutex);
+        auto it = shard.pathToIndex.find(path);
+        if (it == shard.pathToIndex.end())
+            return false;
+        outIndex = it->second;
+        return true;
+    }
+
+    // NOTE: can be called in parallel
+    void Add(HashedString path, DetailIndex index)
+    {
+        Shard& shard = shards[(path.hash >> 32) % kShardCount];
+        std::unique_lock lock(shard.mutex);
+        if (shard.pathToIndex.find(path) != shard.pathToIndex.end())
+            return;
+        char* strCopy = (char*)ArenaAllocate(path.len);
+        memcpy(strCopy, path.str, path.len);
+        path.str = strCopy;
+        shard.pathToIndex.insert(std::make_pair(path, index));
+    }
+
+    enum { kShardCount = 64 };
+    struct alignas(64) Shard
+    {
+        std::shared_mutex mutex;
+        NameToIndexMap pathToIndex;
+    };
+    Shard shards[kShardCount];
+};
+
+static bool IsObjectFileName(std::string_view name)
+{
+    return utils::EndsWith(name, ".o") || utils::EndsWith(name, ".obj");
+}
+
+// Finds object files next to trace files, by listing the directory once, instead of checking
+// whether each possible object file exists. Each directory is only listed once; the ones that
+// were already listed while finding trace files are not listed at all.
+struct ObjectFileResolver
+{
+    // dir: directory path with a trailing slash
+    // NOTE: can be called in parallel
+    void AddDir(const std::string& dir, std::vector<std::string>& objectFiles)
+    {
+        ska::bytell_hash_set<std::string> files;
+        for (auto& f : objectFiles)
+            files.insert(FileKey(f));
+        std::unique_lock lock(mutex);
+        dirs.insert(std::make_pair(dir, std::move(files)));
+    }
+
+    // Path of the object file (.o, then .obj) for a trace file path, or empty if there is none.
+    // NOTE: can be called in parallel
+    std::string Resolve(std::string_view jsonPath)
+    {
+        size_t slash = jsonPath.find_last_of("/\\");
+        std::string dir = slash == std::string::npos ? std::string() : std::string(jsonPath.substr(0, slash + 1));
+        std::replace(dir.begin(), dir.end(), '\\', '/');
+        std::string name = std::string(jsonPath.substr(dir.size(), jsonPath.size() - dir.size() - 4)) + "o";
+        std::string_view prefix = jsonPath.substr(0, dir.size());
+
+        std::shared_lock lock(mutex);
+        auto it = dirs.find(dir);
+        if (it == dirs.end())
+        {
+            lock.unlock();
+            std::vector<std::string> objectFiles;
+            ListObjectFiles(dir, objectFiles);
+            AddDir(dir, objectFiles);
+            lock.lock();
+            it = dirs.find(dir);
+        }
+        // check for .o, then for .obj
+        if (it->second.find(FileKey(name)) != it->second.end())
+            return std::string(prefix) + name;
+        name += "bj";
+        if (it->second.find(FileKey(name)) != it->second.end())
+            return std::string(prefix) + name;
+        return std::string();
+    }
+
+    static void ListObjectFiles(const std::string& dir, std::vector<std::string>& outFiles)
+    {
+        // trace file directory might not exist, e.g. for files from an archive or a stream
+        const char* path = dir.empty() ? "." : dir.c_str();
+        struct stat st;
+        if (stat(path, &st) != 0 || (st.st_mode & S_IFMT) != S_IFDIR)
+            return;
+        cf_dir_t d;
+        if (!cf_dir_open(&d, path))
+            return;
+        while (d.has_next)
+        {
+            // only the names are needed, so no stat() of each entry
+#ifdef _WIN32
+            const char* name = d.fdata.cFileName;
+#else
+            const char* name = d.entry->d_name;
+#endif
+            if (IsObjectFileName(name))
+                outFiles.emplace_back(name);
+            cf_dir_next(&d);
+        }
+        cf_dir_close(&d);
+    }
+
+    static std::string FileKey(std::string name)
+    {
+#ifdef _WIN32
+        // file names are not case sensitive
+        std::transform(name.begin(), name.end(), name.begin(), [](char c) { return (char)tolower(c); });
+#endif
+        return name;
+    }
+
+    std::shared_mutex mutex;
+    // key is directory path, value is object file names in it
+    ska::bytell_hash_map<std::string, ska::bytell_hash_set<std::string>> dirs;
+};
+
 
 static void DebugPrintEvents(const BuildEvents& events, const BuildNames& names)
 {
@@ -58,17 +284,51 @@ static void DebugPrintEvents(const BuildEvents& events, const BuildNames& names)
     {
         const BuildEvent& event = events[EventIndex(int(i))];
         const std::string_view namesSubstr = names[event.detailIndex].substr(0, 130);
-        printf("%4zi: t=%i t1=%7" PRId64 " t2=%7" PRId64 " par=%4i ch=%4zi det=%.*s\n", i, (int) event.type, event.ts, event.ts+event.dur, event.parent.idx, event.children.size(), (int)namesSubstr.size(), namesSubstr.data());
+        printf("%4zi: t=%i t1=%7" PRId64 " t2=%7" PRId64 " par=%4i det=%.*s\n", i, (int) event.type, event.ts, event.ts+event.dur, event.parent.idx, (int)namesSubstr.size(), namesSubstr.data());
     }
 }
 
-static void FindParentChildrenIndices(BuildEvents& events)
+// Clang writes out complete events as they end, so children always go before their parent,
+// and siblings go in order. Then the hierarchy can be built in one pass, with a stack of the
+// events that do not have a parent yet: each event becomes the parent of the stack events
+// that it contains. Returns false if the events are not like that (e.g. they overlap without
+// nesting); the caller has to sort them then.
+static bool FindParentIndicesInEndOrder(BuildEvents& events, std::vector<EventIndex>& stack)
 {
-    if (events.empty())
-        return;
+    stack.clear();
+    int64_t prevEnd = INT64_MIN;
+    for (int i = 0, n = (int)events.size(); i != n; ++i)
+    {
+        BuildEvent& ev = events[EventIndex(i)];
+        // zero length events can be inside two adjacent events; which one is the parent
+        // is up to the sort order then
+        int64_t end = ev.ts + ev.dur;
+        if (ev.dur <= 0 || end < prevEnd)
+            return false;
+        prevEnd = end;
+
+        ev.parent.idx = -1;
+        while (!stack.empty())
+        {
+            BuildEvent& top = events[stack.back()];
+            if (top.ts < ev.ts)
+            {
+                // not within this event, so it has to end before this one starts
+                if (top.ts + top.dur > ev.ts)
+                    return false;
+                break;
+            }
+            top.parent = EventIndex(i);
+            stack.pop_back();
+        }
+        stack.emplace_back(EventIndex(i));
+    }
+    return true;
+}
 
+static void FindParentIndicesSorted(BuildEvents& events, std::vector<EventIndex>& sortedIndices)
+{
     // sort events by start time so that parent events go before child events
-    std::vector<EventIndex> sortedIndices;
     sortedIndices.resize(events.size());
     for (int i = 0, n = (int)events.size(); i != n; ++i)
         sortedIndices[i] = EventIndex(i);
@@ -100,7 +360,6 @@ static void FindParentChildrenIndices(BuildEvents& events)
             if (ev2->ts >= evRoot->ts && ev2->ts+ev2->dur <= evRoot->ts+evRoot->dur)
             {
                 ev2->parent.idx = root;
-                evRoot->children.push_back(EventIndex(i));
                 break;
             }
 
@@ -116,14 +375,45 @@ static void FindParentChildrenIndices(BuildEvents& events)
         evRoot = &events[sortedIndices[i]];
     }
 
-    // fixup event parent/child indices to be into "events" array
+    // fixup event parent indices to be into "events" array
     for (auto& e : events)
     {
-        for (auto& c : e.children)
-            c = sortedIndices[c.idx];
         if (e.parent.idx != -1)
             e.parent = sortedIndices[e.parent.idx];
     }
+}
+
+static void FindParentChildrenIndices(BuildEvents& events, std::vector<EventIndex>& sortedIndices, BuildEventChildren& outChildren)
+{
+    outChildren.offsets.assign(events.size() + 1, 0);
+    outChildren.indices.clear();
+    if (events.empty())
+        return;
+
+    bool inEndOrder = FindParentIndicesInEndOrder(events, sortedIndices);
+    if (!inEndOrder)
+        FindParentIndicesSorted(events, sortedIndices);
+
+    // children lists, in the order of event start times: count the children of each
+    // event first, then put each child into place
+    for (const auto& e : events)
+    {
+        if (e.parent.idx != -1)
+            ++outChildren.offsets[e.parent.idx + 1];
+    }
+    for (size_t i = 1; i < outChildren.offsets.size(); ++i)
+        outChildren.offsets[i] += outChildren.offsets[i - 1];
+    outChildren.indices.resize(outChildren.offsets.back());
+    {
+        std::vector<uint32_t> fill(outChildren.offsets.begin(), outChildren.offsets.end() - 1);
+        for (int i = 0, n = (int)events.size(); i != n; ++i)
+        {
+            EventIndex child = inEndOrder ? EventIndex(i) : sortedIndices[i];
+            int parent = events[child].parent.idx;
+            if (parent != -1)
+                outChildren.indices[fill[parent]++] = child;
+        }
+    }
 
 #ifndef NDEBUG
     for (int i = 0, n = (int)events.size(); i != n; ++i)
@@ -159,124 +449,444 @@ static void SanitizeEvents(BuildEvents& events)
     }
 }
 
+// Per worker thread state that is reused between parsed files, so that
+// parser buffers, hash maps and event arrays are not allocated anew for
+// each file.
+struct BuildEventsParseContext
+{
+    BuildEventsParseContext()
+    {
+        fileEvents.reserve(256);
+    }
+
+    bool ReadFile(const std::string& fileName)
+    {
+        FILE* f = fopen(fileName.c_str(), "rb");
+        if (f == nullptr)
+            return false;
+        fseek(f, 0, SEEK_END);
+        int64_t fsize = ftello64(f);
+        fseek(f, 0, SEEK_SET);
+        if (fsize < 0)
+        {
+            fclose(f);
+            return false;
+        }
+        fileSize = size_t(fsize);
+        if (fileCapacity < fileSize + kJsonPadding)
+        {
+            // grow without preserving (or zero-filling) old contents
+            fileCapacity = std::max(fileSize + kJsonPadding, fileCapacity * 2);
+            fileBuffer.reset(new char[fileCapacity]);
+        }
+        memset(fileBuffer.get() + fileSize, 0, kJsonPadding);
+        size_t read = fileSize != 0 ? fread(fileBuffer.get(), fileSize, 1, f) : 1;
+        fclose(f);
+        return read == 1;
+    }
+
+    // start parsing a new file: clear the per-file data, keeping the allocated memory
+    void BeginFile()
+    {
+        fileEvents.clear();
+    }
+
+    std::unique_ptr<char[]> fileBuffer;
+    size_t fileCapacity = 0;
+    size_t fileSize = 0;
+    // ingest cache key of the file being parsed
+    uint64_t curSize = 0;
+    int64_t curModTime = 0;
+    uint64_t curHash = 0;
+    simdjson::ondemand::parser onDemandParser;
+    simdjson::dom::parser domParser;
+
+    BuildEvents fileEvents; // detail indices are into parser names already
+    BuildEventChildren fileChildren;
+    std::vector<EventIndex> sortedIndices;
+};
+
+// Parsed (hierarchy-resolved and sanitized) event of a trace file, as stored in the ingest cache.
+struct CachedEvent
+{
+    int64_t ts;
+    int64_t dur;
+    int32_t type;
+    int32_t detailIndex;
+    int32_t parent;
+    uint32_t childCount; // children are stored in a separate array, in order
+};
+static_assert(sizeof(CachedEvent) == 32, "CachedEvent is written to cache file as is");
+
+// Parsed events of one trace file, as stored in the ingest cache.
+struct CachedFileEvents
+{
+    uint64_t size = 0;
+    int64_t modTime = 0;
+    uint64_t hash = 0;
+    bool isTrace = false; // false for .json files that are not clang trace files
+    // for files parsed in this run, event detail indices are into parser names;
+    // for files loaded from the cache, into the names of the cache file
+    bool parsedNames = false;
+    std::vector<CachedEvent> events;
+    std::vector<int32_t> children;
+};
+typedef ska::bytell_hash_map<std::string, CachedFileEvents> FileEventsCache;
+
+// Events of one file, waiting to be merged into the final result.
+struct FileResult
+{
+    std::string fileName;
+    // parent/children indices are within the file
+    BuildEvents events;
+    BuildEventChildren children;
+};
 
 struct BuildEventsParser
 {
     BuildEventsParser()
     {
         // make sure zero index is empty
-        NameToIndex("", resultNameToIndex);
-        resultNames.push_back(std::string_view(resultNameToIndex.begin()->first.str, 0));
-
-        resultEvents.reserve(2048);
-        resultNames.reserve(2048);
+        NameToIndex("");
     }
 
-    BuildEvents resultEvents;
-    BuildNames resultNames;
-    NameToIndexMap resultNameToIndex;
+    NameTable names;
+    PathCache paths;
+    ObjectFileResolver objectFiles;
+    std::vector<FileResult> fileResults;
     std::mutex resultMutex;
-    std::mutex arenaMutex;
 
-    void AddEvents(BuildEvents& add, const NameToIndexMap& nameToIndex)
+    // final merged result; detail indices are into resultNames
+    bool merged = false;
+    std::vector<size_t> fileEventOffsets;
+    std::vector<size_t> fileChildOffsets;
+    std::vector<int> resultNameRemap;
+    BuildEvents resultEvents;
+    BuildEventChildren resultChildren;
+    std::vector<std::string_view> resultNames;
+
+    std::vector<std::unique_ptr<BuildEventsParseContext>> contexts;
+
+    bool useCache = false;
+    bool cacheChanged = false;
+    FileEventsCache cacheIn;  // loaded from cache file; not modified while parsing (other than data moved out)
+    FileEventsCache cacheOut; // files seen in this run, to be saved into cache file
+    std::vector<std::string_view> cacheInNames;
+    std::unique_ptr<std::atomic<int>[]> cacheInNameToResult; // name index of each cache name, once it is used
+    std::mutex cacheMutex;
+
+    BuildEventsPruning pruning;
+    bool pruneEvents = false;
+    bool pruneHeaders = false;
+    DetailIndex otherName;
+
+    void SetPruning(const BuildEventsPruning& p)
     {
-        // we got job-local build events and name-to-index mapping;
-        // add them to the global result with any necessary remapping.
-        // gotta take a mutex since we're modifying shared state here.
-        std::scoped_lock lock(resultMutex);
+        pruning = p;
+        pruneHeaders = !pruning.includeHeaders.empty() || !pruning.excludeHeaders.empty();
+        pruneEvents = pruneHeaders;
+        for (int64_t us : pruning.minDurationUs)
+            pruneEvents |= us > 0;
+        otherName = NameToIndex("(other)");
+    }
 
-        // move events to end of result events list
-        int offset = (int)resultEvents.size();
-        std::move(add.begin(), add.end(), std::back_inserter(resultEvents));
-        add.clear();
+    static bool PassesFilter(std::string_view path, const std::vector<std::string>& include, const std::vector<std::string>& exclude)
+    {
+        if (!include.empty() && std::none_of(include.begin(), include.end(), [&](const std::string& p) { return utils::GlobMatch(p, path); }))
+            return false;
+        return std::none_of(exclude.begin(), exclude.end(), [&](const std::string& p) { return utils::GlobMatch(p, path); });
+    }
 
-        // create remapping from name indices, adding them to global remapping
-        // list if necessary.
-        ska::bytell_hash_map<DetailIndex, DetailIndex> detailRemap;
-        for (const auto& kvp : nameToIndex)
+    bool IsUnitPruned(const std::string& curFileName) const
+    {
+        return !PassesFilter(curFileName, pruning.includeUnits, pruning.excludeUnits);
+    }
+
+    bool IsEventPruned(const BuildEvent& ev) const
+    {
+        // the compilation level events are never pruned
+        if (ev.type == BuildEventType::kCompiler || ev.type == BuildEventType::kFrontend || ev.type == BuildEventType::kBackend || ev.type == BuildEventType::kOptModule)
+            return false;
+        if (ev.dur < pruning.minDurationUs[int(ev.type)])
+            return true;
+        if (pruneHeaders && ev.type == BuildEventType::kParseFile)
+            return !PassesFilter(names[ev.detailIndex], pruning.includeHeaders, pruning.excludeHeaders);
+        return false;
+    }
+
+    // Removes pruned events of one file, with their time summed into "(other)" events
+    // (of kOther type): one for each kept parent. The kept events stay in the same order,
+    // and the "(other)" events go after them.
+    void PruneFileEvents(BuildEvents& events, BuildEventChildren& children)
+    {
+        const int n = int(events.size());
+        std::vector<bool> keep(n);
+        for (int i = 0; i != n; ++i)
+            keep[i] = !IsEventPruned(events[EventIndex(i)]);
+        // parse events above kept ones are kept too, so that include chains stay the same
+        for (int i = 0; i != n; ++i)
         {
-            const auto& existing = resultNameToIndex.find(kvp.first);
-            if (existing == resultNameToIndex.end())
-            {
-                DetailIndex index((int)resultNameToIndex.size());
-                resultNameToIndex.insert(std::make_pair(kvp.first, index));
-                resultNames.push_back(std::string_view(kvp.first.str, kvp.first.len));
-                detailRemap[kvp.second] = index;
-            }
-            else
+            if (!keep[i])
+                continue;
+            for (EventIndex p = events[EventIndex(i)].parent; p.idx != -1 && !keep[p.idx]; p = events[p].parent)
             {
-                detailRemap[kvp.second] = existing->second;
+                if (events[p].type == BuildEventType::kParseFile)
+                    keep[p.idx] = true;
             }
         }
+        std::vector<int> newIndex(n, -1);
+        int kept = 0;
+        for (int i = 0; i != n; ++i)
+        {
+            if (keep[i])
+                newIndex[i] = kept++;
+        }
+        if (kept == n)
+            return;
 
-        // adjust the added event indices
-        for (size_t i = offset, n = resultEvents.size(); i != n; ++i)
+        // nearest kept ancestor of each event
+        auto keptParent = [&](EventIndex p)
         {
-            BuildEvent& ev = resultEvents[EventIndex(int(i))];
-            if (ev.parent.idx >= 0)
-                ev.parent.idx += offset;
-            for (auto& ch : ev.children)
-                ch.idx += offset;
-            if (ev.detailIndex.idx != 0)
+            while (p.idx != -1 && newIndex[p.idx] == -1)
+                p = events[p].parent;
+            return p;
+        };
+
+        // only the outermost pruned events are summed; nested ones are already in their time
+        std::map<int, int64_t> others; // key is kept parent
+        for (int i = 0; i != n; ++i)
+        {
+            const BuildEvent& ev = events[EventIndex(i)];
+            if (newIndex[i] == -1 && ev.parent.idx != -1 && newIndex[ev.parent.idx] != -1)
+                others[ev.parent.idx] += ev.dur;
+        }
+
+        BuildEvents result;
+        BuildEventChildren resultChildren;
+        result.reserve(kept + others.size());
+        resultChildren.offsets.reserve(kept + others.size() + 1);
+        resultChildren.offsets.emplace_back(0);
+        // children of pruned events are spliced into the list of their kept parent;
+        // the "(other)" events of a parent go after its other children
+        auto otherIt = others.begin();
+        int otherIndex = kept;
+        std::vector<EventIndex> stack;
+        for (int i = 0; i != n; ++i)
+        {
+            if (newIndex[i] == -1)
+                continue;
+            BuildEvent dst = events[EventIndex(i)];
+            EventIndex p = keptParent(dst.parent);
+            dst.parent.idx = p.idx == -1 ? -1 : newIndex[p.idx];
+            result.emplace_back(dst);
+            stack.assign(std::reverse_iterator<const EventIndex*>(children.End(EventIndex(i))), std::reverse_iterator<const EventIndex*>(children.Begin(EventIndex(i))));
+            while (!stack.empty())
             {
-                assert(ev.detailIndex.idx >= 0);
-                assert(ev.detailIndex.idx < static_cast<int>(nameToIndex.size()));
-                ev.detailIndex = detailRemap[ev.detailIndex];
-                assert(ev.detailIndex.idx >= 0);
-                assert(ev.detailIndex.idx < static_cast<int>(resultNameToIndex.size()));
+                EventIndex ch = stack.back();
+                stack.pop_back();
+                if (newIndex[ch.idx] != -1)
+                    resultChildren.indices.emplace_back(newIndex[ch.idx]);
+                else
+                    stack.insert(stack.end(), std::reverse_iterator<const EventIndex*>(children.End(ch)), std::reverse_iterator<const EventIndex*>(children.Begin(ch)));
             }
+            for (; otherIt != others.end() && otherIt->first == i; ++otherIt)
+                resultChildren.indices.emplace_back(otherIndex++);
+            resultChildren.offsets.emplace_back(uint32_t(resultChildren.indices.size()));
+        }
+        for (const auto& o : others)
+        {
+            BuildEvent dst;
+            dst.type = BuildEventType::kOther;
+            dst.ts = events[EventIndex(o.first)].ts;
+            dst.dur = o.second;
+            dst.detailIndex = otherName;
+            dst.phase = 'X';
+            dst.parent.idx = newIndex[o.first];
+            result.emplace_back(dst);
+            resultChildren.offsets.emplace_back(uint32_t(resultChildren.indices.size()));
         }
+        events.swap(result);
+        children.offsets.swap(resultChildren.offsets);
+        children.indices.swap(resultChildren.indices);
+    }
+
+    void AddEvents(const std::string& curFileName, BuildEvents& add, BuildEventChildren& addChildren)
+    {
+        // we got job-local build events, with name indices that are global already;
+        // keep them until all files are parsed, and merge in a deterministic order then.
+        // the events are moved into an exactly sized array, so that the job-local one
+        // keeps its capacity for the next file.
+        if (pruneEvents)
+            PruneFileEvents(add, addChildren);
+        FileResult res;
+        res.fileName = curFileName;
+        res.events.assign(add.begin(), add.end());
+        res.children.offsets.assign(addChildren.offsets.begin(), addChildren.offsets.end());
+        res.children.indices.assign(addChildren.indices.begin(), addChildren.indices.end());
+        add.clear();
 
-        assert(resultNameToIndex.size() == resultNames.size());
+        std::scoped_lock lock(resultMutex);
+        fileResults.emplace_back(std::move(res));
     }
 
+    // Order of files in the result: by name, and if there are several with the same
+    // name (e.g. in a stream), by their contents. Never depends on the order they were parsed in.
+    bool FileResultLess(const FileResult& a, const FileResult& b) const
+    {
+        if (a.fileName != b.fileName)
+            return a.fileName < b.fileName;
+        if (a.events.size() != b.events.size())
+            return a.events.size() < b.events.size();
+        for (size_t i = 0, n = a.events.size(); i != n; ++i)
+        {
+            const BuildEvent& ea = a.events[EventIndex(int(i))];
+            const BuildEvent& eb = b.events[EventIndex(int(i))];
+            if (ea.type != eb.type)
+                return ea.type < eb.type;
+            if (ea.ts != eb.ts)
+                return ea.ts < eb.ts;
+            if (ea.dur != eb.dur)
+                return ea.dur < eb.dur;
+            if (ea.parent != eb.parent)
+                return ea.parent < eb.parent;
+            if (ea.detailIndex != eb.detailIndex)
+                return names[ea.detailIndex] < names[eb.detailIndex];
+        }
+        return false;
+    }
 
-    DetailIndex NameToIndex(const char* str, NameToIndexMap& nameToIndex)
+    uint32_t BeginMerge()
     {
-        HashedString hashedName(str);
-        auto it = nameToIndex.find(hashedName);
-        if (it != nameToIndex.end())
-            return it->second;
+        std::sort(fileResults.begin(), fileResults.end(), [&](const FileResult& a, const FileResult& b) { return FileResultLess(a, b); });
+
+        // where the events (and children) of each file go in the result
+        fileEventOffsets.resize(fileResults.size());
+        fileChildOffsets.resize(fileResults.size());
+        size_t eventCount = 0;
+        size_t childCount = 0;
+        for (size_t i = 0, n = fileResults.size(); i != n; ++i)
+        {
+            fileEventOffsets[i] = eventCount;
+            fileChildOffsets[i] = childCount;
+            eventCount += fileResults[i].events.size();
+            childCount += fileResults[i].children.indices.size();
+        }
+        resultEvents.clear();
+        resultEvents.resize(eventCount);
+        resultChildren.offsets.resize(eventCount + 1);
+        resultChildren.offsets[eventCount] = uint32_t(childCount);
+        resultChildren.indices.resize(childCount);
+
+        // name table indices depend on which thread got to a name first; number
+        // the names in order of their first use instead
+        resultNameRemap.assign(names.Size(), -1);
+        resultNames.clear();
+        resultNameRemap[0] = 0;
+        resultNames.emplace_back(names[DetailIndex(0)]);
+        for (const FileResult& file : fileResults)
+        {
+            for (const BuildEvent& ev : file.events)
+            {
+                int& index = resultNameRemap[ev.detailIndex.idx];
+                if (index < 0)
+                {
+                    index = (int)resultNames.size();
+                    resultNames.emplace_back(names[ev.detailIndex]);
+                }
+            }
+        }
+        merged = true;
+        return uint32_t(fileResults.size());
+    }
 
-        char* strCopy;
+    void MergeFile(uint32_t index)
+    {
+        FileResult& file = fileResults[index];
+        int offset = (int)fileEventOffsets[index];
+        uint32_t childOffset = (uint32_t)fileChildOffsets[index];
+        for (size_t i = 0, n = file.events.size(); i != n; ++i)
         {
-            // arena allocator is not thread safe, take a mutex
-            std::scoped_lock lock(arenaMutex);
-            strCopy = (char*)ArenaAllocate(hashedName.len+1);
+            BuildEvent& ev = resultEvents[EventIndex(offset + int(i))];
+            ev = file.events[EventIndex(int(i))];
+            if (ev.parent.idx >= 0)
+                ev.parent.idx += offset;
+            ev.detailIndex.idx = resultNameRemap[ev.detailIndex.idx];
+            ev.phase = 0; // not needed past parsing; events from the cache don't have it
+            resultChildren.offsets[offset + i] = childOffset + file.children.offsets[i];
         }
-        memcpy(strCopy, str, hashedName.len+1);
-        hashedName.str = strCopy;
+        EventIndex* children = resultChildren.indices.data() + childOffset;
+        for (size_t i = 0, n = file.children.indices.size(); i != n; ++i)
+            children[i].idx = file.children.indices[i].idx + offset;
+        file.events = BuildEvents();
+        file.children = BuildEventChildren();
+    }
 
-        DetailIndex index((int)nameToIndex.size());
-        nameToIndex.insert(std::make_pair(hashedName, index));
-        return index;
+    DetailIndex NameToIndex(std::string_view str)
+    {
+        return names.Intern(HashedString(str));
     }
 
-    bool ParseRoot(simdjson::dom::element& it, const std::string& curFileName)
+    bool ParseRoot(simdjson::dom::element& it, const std::string& curFileName, BuildEventsParseContext& ctx)
     {
         simdjson::dom::element nit;
         if (it["traceEvents"].get(nit))
             return false;
-        return ParseTraceEvents(nit, curFileName);
+        return ParseTraceEvents(nit, curFileName, ctx);
     }
 
-    bool ParseTraceEvents(simdjson::dom::element& it, const std::string& curFileName)
+    bool ParseTraceEvents(simdjson::dom::element& it, const std::string& curFileName, BuildEventsParseContext& ctx)
     {
         if (!it.is_array())
             return false;
 
-        NameToIndexMap nameToIndexLocal;
-        NameToIndex("", nameToIndexLocal); // make sure zero index is empty
-        BuildEvents fileEvents;
-        fileEvents.reserve(256);
+        ctx.BeginFile();
         for (simdjson::dom::element nit : it)
         {
-            ParseEvent(nit, curFileName, fileEvents, nameToIndexLocal);
+            ParseEvent(nit, curFileName, ctx.fileEvents);
+        }
+        return AddFileEvents(curFileName, ctx);
+    }
+
+    // Streaming variant of ParseRoot: walks "traceEvents" with the simdjson on-demand
+    // API, without building a DOM tree of the whole file. Returns an error if the file
+    // could not be handled that way; caller should fall back to the DOM path then.
+    simdjson::error_code ParseRootOnDemand(simdjson::ondemand::document& doc, const std::string& curFileName, BuildEventsParseContext& ctx, bool& outResult)
+    {
+        using namespace simdjson;
+        outResult = false;
+        ondemand::object root;
+        error_code error = doc.get_object().get(root);
+        if (error)
+            return error;
+        ondemand::array traceEvents;
+        error = root.find_field_unordered("traceEvents").get_array().get(traceEvents);
+        if (error == NO_SUCH_FIELD)
+            return SUCCESS; // valid JSON, just not a trace file
+        if (error)
+            return error;
+
+        ctx.BeginFile();
+        for (auto element : traceEvents)
+        {
+            ondemand::object node;
+            error = element.get_object().get(node);
+            if (error)
+                return error;
+            error = ParseEventOnDemand(node, curFileName, ctx.fileEvents);
+            if (error)
+                return error;
         }
+        outResult = AddFileEvents(curFileName, ctx);
+        return SUCCESS;
+    }
+
+    bool AddFileEvents(const std::string& curFileName, BuildEventsParseContext& ctx)
+    {
+        BuildEvents& fileEvents = ctx.fileEvents;
         if (fileEvents.empty())
             return false;
 
-        FindParentChildrenIndices(fileEvents);
+        FindParentChildrenIndices(fileEvents, ctx.sortedIndices, ctx.fileChildren);
         if (fileEvents.back().parent.idx != -1)
         {
             printf("%sWARN: the last trace event should be root; was not in '%s'.%s\n", col::kRed, curFileName.c_str(), col::kReset);
@@ -285,10 +895,100 @@ struct BuildEventsParser
 
         SanitizeEvents(fileEvents);
 
-        AddEvents(fileEvents, nameToIndexLocal);
+        if (useCache)
+            StoreInCache(curFileName, ctx, true);
+        if (IsUnitPruned(curFileName))
+        {
+            fileEvents.clear();
+            return true;
+        }
+        AddEvents(curFileName, fileEvents, ctx.fileChildren);
         return true;
     }
 
+    // Puts the parsed events of the current file into the cache for the next run.
+    void StoreInCache(const std::string& curFileName, const BuildEventsParseContext& ctx, bool isTrace)
+    {
+        CachedFileEvents cached;
+        cached.size = ctx.curSize;
+        cached.modTime = ctx.curModTime;
+        cached.hash = ctx.curHash;
+        cached.isTrace = isTrace;
+        cached.parsedNames = true;
+        if (isTrace)
+        {
+            cached.events.resize(ctx.fileEvents.size());
+            for (size_t i = 0, n = ctx.fileEvents.size(); i != n; ++i)
+            {
+                const BuildEvent& ev = ctx.fileEvents[EventIndex(int(i))];
+                CachedEvent& cev = cached.events[i];
+                cev.ts = ev.ts;
+                cev.dur = ev.dur;
+                cev.type = int32_t(ev.type);
+                cev.detailIndex = ev.detailIndex.idx;
+                cev.parent = ev.parent.idx;
+                cev.childCount = ctx.fileChildren.Count(EventIndex(int(i)));
+            }
+            cached.children.resize(ctx.fileChildren.indices.size());
+            for (size_t i = 0, n = cached.children.size(); i != n; ++i)
+                cached.children[i] = ctx.fileChildren.indices[i].idx;
+        }
+        std::scoped_lock lock(cacheMutex);
+        cacheOut[curFileName] = std::move(cached);
+        cacheChanged = true;
+    }
+
+    // Adds events of a file loaded from the cache, same as if the file was parsed.
+    bool AddCachedEvents(const std::string& curFileName, CachedFileEvents& cached, int64_t modTime)
+    {
+        bool isTrace = cached.isTrace;
+        if (isTrace && !IsUnitPruned(curFileName))
+        {
+            // the name index of each cache name is only looked up once in the whole run
+            for (const CachedEvent& cev : cached.events)
+            {
+                std::atomic<int>& index = cacheInNameToResult[cev.detailIndex];
+                if (cev.detailIndex != 0 && index.load(std::memory_order_relaxed) == 0)
+                    index.store(names.Intern(HashedString(cacheInNames[cev.detailIndex]), true).idx, std::memory_order_relaxed);
+            }
+
+            // same as AddEvents
+            FileResult res;
+            res.fileName = curFileName;
+            res.events.resize(cached.events.size());
+            res.children.offsets.resize(cached.events.size() + 1);
+            res.children.offsets[0] = 0;
+            for (size_t i = 0, n = cached.events.size(); i != n; ++i)
+            {
+                const CachedEvent& cev = cached.events[i];
+                BuildEvent& ev = res.events[EventIndex(int(i))];
+                ev.type = BuildEventType(cev.type);
+                ev.ts = cev.ts;
+                ev.dur = cev.dur;
+                ev.parent.idx = cev.parent;
+                ev.detailIndex.idx = cacheInNameToResult[cev.detailIndex].load(std::memory_order_relaxed);
+                res.children.offsets[i + 1] = res.children.offsets[i] + cev.childCount;
+            }
+            res.children.indices.resize(cached.children.size());
+            for (size_t i = 0, n = cached.children.size(); i != n; ++i)
+                res.children.indices[i].idx = cached.children[i];
+            if (pruneEvents)
+                PruneFileEvents(res.events, res.children);
+            std::scoped_lock lock(resultMutex);
+            fileResults.emplace_back(std::move(res));
+        }
+
+        // the data is not needed in the input cache anymore; move it to the output one
+        std::scoped_lock lock(cacheMutex);
+        if (cached.modTime != modTime)
+        {
+            cached.modTime = modTime;
+            cacheChanged = true;
+        }
+        cacheOut[curFileName] = std::move(cached);
+        return isTrace;
+    }
+
     static bool StrEqual(std::string_view a, const char* b)
     {
         return a == b;
@@ -299,6 +999,36 @@ struct BuildEventsParser
         return static_cast<int>(a.size()) >= blen && a.compare(0, blen, b) == 0;
     }
 
+    static BuildEventType EventTypeFromName(std::string_view name)
+    {
+        if (StrEqual(name, "ExecuteCompiler"))
+            return BuildEventType::kCompiler;
+        if (StrEqual(name, "Frontend"))
+            return BuildEventType::kFrontend;
+        if (StrEqual(name, "Backend"))
+            return BuildEventType::kBackend;
+        if (StrEqual(name, "Source"))
+            return BuildEventType::kParseFile;
+        if (StrEqual(name, "ParseTemplate"))
+            return BuildEventType::kParseTemplate;
+        if (StrEqual(name, "ParseClass"))
+            return BuildEventType::kParseClass;
+        if (StrEqual(name, "InstantiateClass"))
+            return BuildEventType::kInstantiateClass;
+        if (StrEqual(name, "InstantiateFunction"))
+            return BuildEventType::kInstantiateFunction;
+        if (StrEqual(name, "OptModule"))
+            return BuildEventType::kOptModule;
+        if (StrEqual(name, "OptFunction"))
+            return BuildEventType::kOptFunction;
+        return BuildEventType::kUnknown;
+    }
+
+    static bool IsValidPhase(std::string_view val)
+    {
+        return StrEqual(val, "X") || StrEqual(val, "b") || StrEqual(val, "e");
+    }
+
     const char* kPid = "pid";
     const char* kTid = "tid";
     const char* kPh = "ph";
@@ -308,7 +1038,7 @@ struct BuildEventsParser
     const char* kArgs = "args";
     const char* kDetail = "detail";
 
-    void ParseEvent(simdjson::dom::element& it, const std::string& curFileName, BuildEvents& fileEvents, NameToIndexMap& nameToIndexLocal)
+    void ParseEvent(simdjson::dom::element& it, const std::string& curFileName, BuildEvents& fileEvents)
     {
         simdjson::dom::object node;
         if (it.get(node))
@@ -341,7 +1071,7 @@ struct BuildEventsParser
                 else
                 {
                     std::string_view val = kv.value.get_string();
-                    if (!StrEqual(val, "X") && !StrEqual(val, "b") && !StrEqual(val, "e"))
+                    if (!IsValidPhase(val))
                         valid = false;
                     else
                         event.phase = val[0];
@@ -349,27 +1079,9 @@ struct BuildEventsParser
             }
             else if (StrEqual(nodeKey, kName) && kv.value.is_string() && valid)
             {
-                std::string_view name = kv.value.get_string();
-                if (StrEqual(name, "ExecuteCompiler"))
-                    event.type = BuildEventType::kCompiler;
-                else if (StrEqual(name, "Frontend"))
-                    event.type = BuildEventType::kFrontend;
-                else if (StrEqual(name, "Backend"))
-                    event.type = BuildEventType::kBackend;
-                else if (StrEqual(name, "Source"))
-                    event.type = BuildEventType::kParseFile;
-                else if (StrEqual(name, "ParseTemplate"))
-                    event.type = BuildEventType::kParseTemplate;
-                else if (StrEqual(name, "ParseClass"))
-                    event.type = BuildEventType::kParseClass;
-                else if (StrEqual(name, "InstantiateClass"))
-                    event.type = BuildEventType::kInstantiateClass;
-                else if (StrEqual(name, "InstantiateFunction"))
-                    event.type = BuildEventType::kInstantiateFunction;
-                else if (StrEqual(name, "OptModule"))
-                    event.type = BuildEventType::kOptModule;
-                else if (StrEqual(name, "OptFunction"))
-                    event.type = BuildEventType::kOptFunction;
+                BuildEventType type = EventTypeFromName(kv.value.get_string());
+                if (type != BuildEventType::kUnknown)
+                    event.type = type;
             }
             else if (StrEqual(nodeKey, kTs))
             {
@@ -397,47 +1109,152 @@ struct BuildEventsParser
             }
         }
 
-        if (event.type== BuildEventType::kUnknown || !valid)
-            return;
+        AddEvent(event, valid, detailPtr, curFileName, fileEvents);
+    }
 
-        // if the "compiler" event has no detail name, use the current json file name
-        if (detailPtr.empty() && event.type == BuildEventType::kCompiler)
-            detailPtr = curFileName;
-        if (!detailPtr.empty())
+    // Reads an integer value the same way DOM is_int64/get_int64 checks do: non-integer
+    // values are not an error, but make the event invalid.
+    static simdjson::error_code GetInt64OnDemand(simdjson::ondemand::value& value, int64_t& out, bool& valid)
+    {
+        using namespace simdjson;
+        ondemand::number num;
+        error_code error = value.get_number().get(num);
+        if (error == INCORRECT_TYPE)
         {
-            std::string detailString;
-            if (event.type == BuildEventType::kParseFile || event.type == BuildEventType::kOptModule)
+            valid = false;
+            return SUCCESS;
+        }
+        if (error)
+            return error;
+        if (num.is_int64())
+            out = num.get_int64();
+        else
+            valid = false;
+        return SUCCESS;
+    }
+
+    simdjson::error_code ParseEventOnDemand(simdjson::ondemand::object& node, const std::string& curFileName, BuildEvents& fileEvents)
+    {
+        using namespace simdjson;
+        BuildEvent event;
+        bool valid = true;
+        std::string_view detailPtr;
+        for (auto field : node)
+        {
+            std::string_view nodeKey;
+            error_code error = field.unescaped_key().get(nodeKey);
+            if (error)
+                return error;
+            ondemand::value value = field.value();
+            if (StrEqual(nodeKey, kPid) || StrEqual(nodeKey, kTid))
             {
-                // do various cleanups/nice-ifications of the detail name:
-                // make paths shorter (i.e. relative to project) where possible
-                detailString = utils::GetNicePath(detailPtr);
+                int64_t unused;
+                error = GetInt64OnDemand(value, unused, valid);
             }
-            else
-                detailString = detailPtr;
-
-            // don't report the clang trace .json file, instead get the object file at the same location if it's there
-            if (utils::EndsWith(detailString, ".json"))
+            else if (StrEqual(nodeKey, kPh))
             {
-                std::string candidate = std::string(detailString.substr(0, detailString.length()-4)) + "o";
-                // check for .o
-                if (cf_file_exists(candidate.c_str()))
-                    detailString = candidate;
-                else
+                std::string_view val;
+                error = value.get_string().get(val);
+                if (error == INCORRECT_TYPE || (!error && !IsValidPhase(val)))
                 {
-                    // check for .obj
-                    candidate += "bj";
-                    if (cf_file_exists(candidate.c_str()))
-                        detailString = candidate;
+                    valid = false;
+                    error = SUCCESS;
                 }
+                else if (!error)
+                    event.phase = val[0];
             }
+            else if (StrEqual(nodeKey, kName) && valid)
+            {
+                std::string_view name;
+                error = value.get_string().get(name);
+                if (error == INCORRECT_TYPE)
+                    error = SUCCESS;
+                else if (!error)
+                {
+                    BuildEventType type = EventTypeFromName(name);
+                    if (type != BuildEventType::kUnknown)
+                        event.type = type;
+                }
+            }
+            else if (StrEqual(nodeKey, kTs))
+                error = GetInt64OnDemand(value, event.ts, valid);
+            else if (StrEqual(nodeKey, kDur))
+                error = GetInt64OnDemand(value, event.dur, valid);
+            else if (StrEqual(nodeKey, kArgs))
+            {
+                ondemand::object args;
+                error = value.get_object().get(args);
+                if (error == INCORRECT_TYPE)
+                    error = SUCCESS;
+                else if (!error)
+                {
+                    // only the first argument is used as the detail
+                    for (auto arg : args)
+                    {
+                        ondemand::value argValue;
+                        error = arg.value().get(argValue);
+                        if (!error)
+                        {
+                            error = argValue.get_string().get(detailPtr);
+                            if (error == INCORRECT_TYPE)
+                                error = SUCCESS;
+                        }
+                        break;
+                    }
+                }
+            }
+            if (error)
+                return error;
+        }
+
+        AddEvent(event, valid, detailPtr, curFileName, fileEvents);
+        return SUCCESS;
+    }
+
+    // The name is interned straight from the parsed JSON, unless it needs changing.
+    DetailIndex DetailToIndex(std::string_view detail)
+    {
+        // don't report the clang trace .json file, instead get the object file at the same location if it's there
+        if (utils::EndsWith(detail, ".json"))
+        {
+            std::string objectFile = objectFiles.Resolve(detail);
+            if (!objectFile.empty())
+                return NameToIndex(objectFile);
+        }
+        return NameToIndex(detail);
+    }
+
+    // Do various cleanups/nice-ifications of the path: make paths shorter (i.e. relative
+    // to project) where possible. Done once per unique path.
+    DetailIndex PathToIndex(std::string_view path)
+    {
+        HashedString rawPath(path);
+        DetailIndex index;
+        if (paths.Find(rawPath, index))
+            return index;
+        index = DetailToIndex(utils::GetNicePath(path));
+        paths.Add(rawPath, index);
+        return index;
+    }
+
+    void AddEvent(BuildEvent& event, bool valid, std::string_view detailPtr, const std::string& curFileName, BuildEvents& fileEvents)
+    {
+        if (event.type== BuildEventType::kUnknown || !valid)
+            return;
+
+        // if the "compiler" event has no detail name, use the current json file name
+        if (detailPtr.empty() && event.type == BuildEventType::kCompiler)
+            detailPtr = curFileName;
+        if (!detailPtr.empty())
+        {
+            // possibly mangled function names are kept as is; they are only demangled
+            // when analysis needs them for the report
+            if (event.type == BuildEventType::kParseFile || event.type == BuildEventType::kOptModule)
+                event.detailIndex = PathToIndex(detailPtr);
+            else
+                event.detailIndex = DetailToIndex(detailPtr);
+        }
 
-            // demangle possibly mangled names
-            if (event.type == BuildEventType::kOptFunction)
-                detailString = llvm::demangle(detailString);
-
-            event.detailIndex = NameToIndex(detailString.c_str(), nameToIndexLocal);
-        }
-
         // starting with clang 19, some Source events are pairs of "b" immediately followed
         // by "e" events. Handle merging of those if needed; do not support other cases of
         // "b"/"e"
@@ -465,9 +1282,12 @@ struct BuildEventsParser
     }
 };
 
-BuildEventsParser* CreateBuildEventsParser()
+BuildEventsParser* CreateBuildEventsParser(uint32_t threadCount)
 {
     BuildEventsParser* p = new BuildEventsParser();
+    p->contexts.resize(std::max(threadCount, 1u));
+    for (auto& ctx : p->contexts)
+        ctx.reset(new BuildEventsParseContext());
     return p;
 }
 void DeleteBuildEventsParser(BuildEventsParser* parser)
@@ -476,20 +1296,309 @@ void DeleteBuildEventsParser(BuildEventsParser* parser)
 }
 
 
-bool ParseBuildEvents(BuildEventsParser* parser, const std::string& fileName)
+static_assert(kJsonPadding >= simdjson::SIMDJSON_PADDING, "JSON buffer padding should be enough for simdjson");
+
+// Sets up the ingest cache key of the file; if the file was touched but its contents did not
+// change, adds the events from the cache and returns true.
+static bool FindInCacheByHash(BuildEventsParser* parser, BuildEventsParseContext& ctx, const std::string& fileName, int64_t modTime, const char* data, size_t size, bool& outResult)
+{
+    if (!parser->useCache)
+        return false;
+    ctx.curSize = size;
+    ctx.curModTime = modTime;
+    ctx.curHash = XXH64(data, size, 0);
+    auto it = parser->cacheIn.find(fileName);
+    if (it == parser->cacheIn.end() || it->second.size != ctx.curSize || it->second.hash != ctx.curHash)
+        return false;
+    outResult = parser->AddCachedEvents(fileName, it->second, modTime);
+    return true;
+}
+
+static bool ParseBuildEventsJson(BuildEventsParser* parser, BuildEventsParseContext& ctx, const std::string& fileName, int64_t modTime, const char* data, size_t size)
 {
     using namespace simdjson;
-    dom::parser p;
-    dom::element doc;
-    auto error = p.load(fileName).get(doc);
-    if (error)
+
+    bool result = false;
+    if (FindInCacheByHash(parser, ctx, fileName, modTime, data, size, result))
+        return result;
+
+    // try the streaming on-demand parser first; it does not build the whole
+    // DOM tree in memory, which matters for large trace files
+    bool parsed = false;
     {
-        printf("%sWARN: JSON parse error in %s: %s.%s\n", col::kYellow, fileName.c_str(), error_message(error), col::kReset);
+        ondemand::document doc;
+        if (!ctx.onDemandParser.iterate(padded_string_view(data, size, size + kJsonPadding)).get(doc) && !parser->ParseRootOnDemand(doc, fileName, ctx, result))
+            parsed = true;
+    }
+
+    if (!parsed)
+    {
+        // on-demand parsing failed (malformed or unusual JSON); fall back to DOM parser
+        dom::element doc;
+        auto error = ctx.domParser.parse(data, size, false).get(doc);
+        if (error)
+        {
+            printf("%sWARN: JSON parse error in %s: %s.%s\n", col::kYellow, fileName.c_str(), error_message(error), col::kReset);
+            return false;
+        }
+        result = parser->ParseRoot(doc, fileName, ctx);
+        //DebugPrintEvents(outEvents, outNames);
+    }
+
+    // remember valid JSON files that are not traces too, so that they are not parsed again
+    if (!result && parser->useCache)
+        parser->StoreInCache(fileName, ctx, false);
+    return result;
+}
+
+void SetBuildEventsPruning(BuildEventsParser* parser, const BuildEventsPruning& pruning)
+{
+    parser->SetPruning(pruning);
+}
+
+void AddKnownObjectFiles(BuildEventsParser* parser, const std::string& dirPath, std::vector<std::string>& objectFiles)
+{
+    parser->objectFiles.AddDir(dirPath, objectFiles);
+}
+
+bool ParseBuildEvents(BuildEventsParser* parser, const std::string& fileName, int64_t modTime, uint32_t threadIndex)
+{
+    assert(threadIndex < parser->contexts.size());
+    BuildEventsParseContext& ctx = *parser->contexts[threadIndex];
+    if (!ctx.ReadFile(fileName))
+    {
+        printf("%sWARN: JSON parse error in %s: %s.%s\n", col::kYellow, fileName.c_str(), simdjson::error_message(simdjson::IO_ERROR), col::kReset);
+        return false;
+    }
+    return ParseBuildEventsJson(parser, ctx, fileName, modTime, ctx.fileBuffer.get(), ctx.fileSize);
+}
+
+bool ParseBuildEvents(BuildEventsParser* parser, const std::string& fileName, int64_t modTime, const char* data, size_t size, uint32_t threadIndex)
+{
+    assert(threadIndex < parser->contexts.size());
+    BuildEventsParseContext& ctx = *parser->contexts[threadIndex];
+    return ParseBuildEventsJson(parser, ctx, fileName, modTime, data, size);
+}
+
+static CachedFileEvents* FindCachedFile(BuildEventsParser* parser, const std::string& fileName, uint64_t size, int64_t modTime)
+{
+    if (!parser->useCache)
+        return nullptr;
+    auto it = parser->cacheIn.find(fileName);
+    if (it == parser->cacheIn.end() || it->second.size != size || it->second.modTime != modTime)
+        return nullptr;
+    return &it->second;
+}
+
+bool IsBuildEventsFileCached(BuildEventsParser* parser, const std::string& fileName, uint64_t size, int64_t modTime)
+{
+    return FindCachedFile(parser, fileName, size, modTime) != nullptr;
+}
+
+bool ParseCachedBuildEvents(BuildEventsParser* parser, const std::string& fileName, uint64_t size, int64_t modTime)
+{
+    CachedFileEvents* cached = FindCachedFile(parser, fileName, size, modTime);
+    if (cached == nullptr)
         return false;
+    return parser->AddCachedEvents(fileName, *cached, modTime);
+}
+
+struct BuildEventsSplit
+{
+    BuildEventsParser* parser = nullptr;
+    std::string fileName;
+    int64_t modTime = 0;
+    BuildEventsParseContext file; // whole file data; events of all chunks get stitched together here
+    std::vector<std::string_view> chunks; // "traceEvents" array elements of each chunk
+    std::vector<BuildEvents> chunkEvents;
+    std::atomic<bool> failed{ false };
+    bool done = false; // file was handled without splitting it
+    bool result = false;
+};
+
+// Finds "traceEvents" array in the file, and splits its elements into roughly equal sized chunks.
+static simdjson::error_code FindTraceEventChunks(BuildEventsSplit& split, uint32_t chunkCount)
+{
+    using namespace simdjson;
+    BuildEventsParseContext& ctx = split.file;
+    const char* data = ctx.fileBuffer.get();
+    size_t size = ctx.fileSize;
+
+    // get the whole array first; this just skips over the JSON structure without parsing values
+    std::string_view array;
+    {
+        ondemand::document doc;
+        ondemand::object root;
+        error_code error = ctx.onDemandParser.iterate(padded_string_view(data, size, size + kJsonPadding)).get(doc);
+        if (!error)
+            error = doc.get_object().get(root);
+        if (!error)
+            error = root.find_field_unordered("traceEvents").raw_json().get(array);
+        if (error)
+            return error;
+    }
+    if (array.size() < 2 || array.front() != '[')
+        return INCORRECT_TYPE;
+
+    // go over the array elements, and start a new chunk once enough bytes were covered
+    size_t arrayCapacity = size - (array.data() - data) + kJsonPadding;
+    ondemand::document doc;
+    ondemand::array elements;
+    error_code error = ctx.onDemandParser.iterate(padded_string_view(array.data(), array.size(), arrayCapacity)).get(doc);
+    if (!error)
+        error = doc.get_array().get(elements);
+    if (error)
+        return error;
+    const size_t chunkSize = array.size() / chunkCount + 1;
+    const char* chunkStart = nullptr;
+    for (auto element : elements)
+    {
+        ondemand::value value;
+        error = element.get(value);
+        if (error)
+            return error;
+        const char* pos = value.raw_json_token().data();
+        if (chunkStart == nullptr)
+            chunkStart = pos;
+        else if (size_t(pos - chunkStart) >= chunkSize)
+        {
+            split.chunks.emplace_back(chunkStart, pos - chunkStart);
+            chunkStart = pos;
+        }
+    }
+    if (chunkStart != nullptr)
+        split.chunks.emplace_back(chunkStart, array.data() + array.size() - 1 - chunkStart);
+
+    // drop separators between the chunks
+    for (auto& chunk : split.chunks)
+    {
+        while (!chunk.empty() && (chunk.back() == ',' || chunk.back() == ' ' || chunk.back() == '\t' || chunk.back() == '\r' || chunk.back() == '\n'))
+            chunk.remove_suffix(1);
+    }
+    return SUCCESS;
+}
+
+BuildEventsSplit* BeginSplitBuildEvents(BuildEventsParser* parser, const std::string& fileName, int64_t modTime, uint32_t chunkCount)
+{
+    BuildEventsSplit* split = new BuildEventsSplit();
+    split->parser = parser;
+    split->fileName = fileName;
+    split->modTime = modTime;
+    BuildEventsParseContext& ctx = split->file;
+    if (!ctx.ReadFile(fileName))
+    {
+        printf("%sWARN: JSON parse error in %s: %s.%s\n", col::kYellow, fileName.c_str(), simdjson::error_message(simdjson::IO_ERROR), col::kReset);
+        split->done = true;
+        return split;
+    }
+    if (FindInCacheByHash(parser, ctx, fileName, modTime, ctx.fileBuffer.get(), ctx.fileSize, split->result))
+    {
+        split->done = true;
+        return split;
+    }
+
+    // if the file can't be split (not a trace file, unusual JSON), parse it as a whole
+    if (FindTraceEventChunks(*split, std::max(chunkCount, 1u)) != simdjson::SUCCESS || split->chunks.empty())
+    {
+        split->chunks.clear();
+        split->result = ParseBuildEventsJson(parser, ctx, fileName, modTime, ctx.fileBuffer.get(), ctx.fileSize);
+        split->done = true;
+        return split;
+    }
+    split->chunkEvents.resize(split->chunks.size());
+    return split;
+}
+
+uint32_t GetSplitBuildEventsChunkCount(BuildEventsSplit* split)
+{
+    return split->done ? 0 : (uint32_t)split->chunks.size();
+}
+
+void ParseSplitBuildEventsChunk(BuildEventsSplit* split, uint32_t chunkIndex, uint32_t threadIndex)
+{
+    using namespace simdjson;
+    BuildEventsParser* parser = split->parser;
+    assert(threadIndex < parser->contexts.size());
+    assert(chunkIndex < split->chunks.size());
+    BuildEventsParseContext& ctx = *parser->contexts[threadIndex];
+
+    // make the chunk a standalone JSON array
+    std::string_view chunk = split->chunks[chunkIndex];
+    size_t size = chunk.size() + 2;
+    if (ctx.fileCapacity < size + kJsonPadding)
+    {
+        ctx.fileCapacity = std::max(size + kJsonPadding, ctx.fileCapacity * 2);
+        ctx.fileBuffer.reset(new char[ctx.fileCapacity]);
+    }
+    char* data = ctx.fileBuffer.get();
+    data[0] = '[';
+    memcpy(data + 1, chunk.data(), chunk.size());
+    data[size - 1] = ']';
+    memset(data + size, 0, kJsonPadding);
+
+    ctx.BeginFile();
+    ondemand::document doc;
+    ondemand::array elements;
+    error_code error = ctx.onDemandParser.iterate(padded_string_view(data, size, size + kJsonPadding)).get(doc);
+    if (!error)
+        error = doc.get_array().get(elements);
+    if (!error)
+    {
+        for (auto element : elements)
+        {
+            ondemand::object node;
+            error = element.get_object().get(node);
+            if (!error)
+                error = parser->ParseEventOnDemand(node, split->fileName, ctx.fileEvents);
+            if (error)
+                break;
+        }
     }
+    if (error)
+        split->failed = true;
+    split->chunkEvents[chunkIndex].swap(ctx.fileEvents);
+}
 
-    return parser->ParseRoot(doc, fileName);
-    //DebugPrintEvents(outEvents, outNames);
+bool EndSplitBuildEvents(BuildEventsSplit* split)
+{
+    BuildEventsParser* parser = split->parser;
+    BuildEventsParseContext& ctx = split->file;
+    if (!split->done && split->failed)
+    {
+        // some chunk had JSON that on-demand parser could not handle; do the whole file
+        // the usual way, which will fall back to DOM parser if needed
+        split->result = ParseBuildEventsJson(parser, ctx, split->fileName, split->modTime, ctx.fileBuffer.get(), ctx.fileSize);
+    }
+    else if (!split->done)
+    {
+        // stitch the chunks together, same as if the whole file was parsed in one go
+        ctx.BeginFile();
+        for (size_t i = 0; i < split->chunks.size(); ++i)
+        {
+            BuildEvents& events = split->chunkEvents[i];
+            size_t first = 0;
+            if (!ctx.fileEvents.empty() && !events.empty() && ctx.fileEvents.back().phase == 'b')
+            {
+                // "b" event at the end of previous chunk; merge with "e" if that follows it
+                BuildEvent& prev = ctx.fileEvents.back();
+                if (events[EventIndex(0)].phase == 'e')
+                {
+                    prev.phase = 'X';
+                    prev.dur = events[EventIndex(0)].ts - prev.ts;
+                    first = 1;
+                }
+                else
+                    ctx.fileEvents.pop_back();
+            }
+            std::move(events.begin() + first, events.end(), std::back_inserter(ctx.fileEvents));
+        }
+        split->result = parser->AddFileEvents(split->fileName, ctx);
+        if (!split->result && parser->useCache)
+            parser->StoreInCache(split->fileName, ctx, false);
+    }
+    bool result = split->result;
+    delete split;
+    return result;
 }
 
 struct BufferedWriter
@@ -581,16 +1690,513 @@ struct BufferedReader
         memcpy(ptr, &buffer[pos], sz);
         pos += sz;
     }
+    size_t Left() const
+    {
+        return bufferSize - pos;
+    }
 
     uint8_t* buffer;
     size_t pos;
     size_t bufferSize;
 };
 
-const uint32_t kFileMagic = 0x43424130; // 'CBA0'
+const uint32_t kFileMagic = 0x43424135; // 'CBA5'
+
+// Data files are laid out so that they can be used in place when loaded: the header,
+// events as is, their children, name tables (same as in BuildNames), and then the block
+// of all the strings. Each part starts at an 8 byte boundary.
+// Compact data files have encoded event blocks instead of the events and their children
+// (see EncodeEventBlocks); the rest is the same.
+struct DataFileHeader
+{
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t eventsCount;
+    uint64_t childrenCount;
+    uint64_t dirsCount;
+    uint64_t tokensCount;
+    uint64_t namesCount;
+    uint64_t nameTokensCount;
+    uint64_t stringsSize;
+    uint64_t eventBlocksSize; // compact files only
+    uint64_t eventsHash; // of the events and their children; of the event blocks in compact files
+};
+
+enum DataFileFlags : uint32_t
+{
+    kDataFileCompact = 1,
+};
+
+// Offsets of data file parts from the file start.
+struct DataFileLayout
+{
+    uint64_t events;
+    uint64_t childOffsets;
+    uint64_t childIndices;
+    uint64_t dirParents;
+    uint64_t dirNameStarts;
+    uint64_t tokenStarts;
+    uint64_t nameDirs;
+    uint64_t nameLeafStarts;
+    uint64_t nameTokenStarts;
+    uint64_t nameTokens;
+    uint64_t strings;
+    uint64_t end;
+};
+
+static uint64_t AlignDataFilePart(uint64_t size)
+{
+    return (size + 7) & ~uint64_t(7);
+}
+
+static DataFileLayout GetDataFileLayout(const DataFileHeader& h)
+{
+    DataFileLayout l;
+    uint64_t pos = sizeof(DataFileHeader);
+    auto Part = [&pos](uint64_t size)
+    {
+        uint64_t start = pos;
+        pos += AlignDataFilePart(size);
+        return start;
+    };
+    if (h.flags & kDataFileCompact)
+    {
+        l.events = Part(h.eventBlocksSize);
+        l.childOffsets = l.childIndices = pos;
+    }
+    else
+    {
+        l.events = Part(h.eventsCount * sizeof(BuildEvent));
+        l.childOffsets = Part((h.eventsCount + 1) * sizeof(uint32_t));
+        l.childIndices = Part(h.childrenCount * sizeof(EventIndex));
+    }
+    l.dirParents = Part(h.dirsCount * sizeof(int32_t));
+    l.dirNameStarts = Part((h.dirsCount + 1) * sizeof(uint64_t));
+    l.tokenStarts = Part((h.tokensCount + 1) * sizeof(uint64_t));
+    l.nameDirs = Part(h.namesCount * sizeof(int32_t));
+    l.nameLeafStarts = Part((h.namesCount + 1) * sizeof(uint64_t));
+    l.nameTokenStarts = Part((h.namesCount + 1) * sizeof(uint32_t));
+    l.nameTokens = Part(h.nameTokensCount * sizeof(uint32_t));
+    l.strings = Part(h.stringsSize);
+    l.end = pos;
+    return l;
+}
+
+// Compact data files store events in blocks of this many events. Each block is encoded on
+// its own, so that they can be decoded in parallel.
+const size_t kEventsPerBlock = 16384;
+
+// 7 bits per byte, high bit set when more bytes follow
+static void AppendVarint(std::vector<uint8_t>& out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(uint8_t(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+static bool ReadVarint(const uint8_t*& ptr, const uint8_t* end, uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && ptr != end; shift += 7)
+    {
+        uint8_t b = *ptr++;
+        v |= uint64_t(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// small negative values get small codes too
+static uint64_t ZigZag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+static int64_t UnZigZag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+// Encodes events into the compact data file form: end offsets of all the blocks, then the
+// blocks. For each event there's the type byte, then varints of: start time as a delta from
+// the previous event in the block (events within a file are close in time), duration,
+// detail index, and parent as a delta from the event index (0 when there's no parent).
+// Children are not stored; analysis only needs the parents.
+static void EncodeEventBlocks(const BuildEvents& events, std::vector<uint8_t>& out)
+{
+    const size_t blockCount = (events.size() + kEventsPerBlock - 1) / kEventsPerBlock;
+    std::vector<uint8_t> blocks;
+    std::vector<uint64_t> blockEnds(blockCount);
+    for (size_t b = 0; b != blockCount; ++b)
+    {
+        int64_t prevTs = 0;
+        for (size_t i = b * kEventsPerBlock, n = std::min(i + kEventsPerBlock, events.size()); i != n; ++i)
+        {
+            const BuildEvent& ev = events[EventIndex(int(i))];
+            blocks.push_back(uint8_t(ev.type));
+            AppendVarint(blocks, ZigZag(ev.ts - prevTs));
+            AppendVarint(blocks, ZigZag(ev.dur));
+            AppendVarint(blocks, uint32_t(ev.detailIndex.idx));
+            AppendVarint(blocks, ev.parent.idx < 0 ? 0 : ZigZag(int64_t(ev.parent.idx) - int64_t(i)));
+            prevTs = ev.ts;
+        }
+        blockEnds[b] = blocks.size();
+    }
+    out.resize(blockCount * sizeof(uint64_t));
+    memcpy(out.data(), blockEnds.data(), out.size());
+    out.insert(out.end(), blocks.begin(), blocks.end());
+}
+
+// Decodes one block of events; returns false when the block data is not valid, or
+// has parent or detail indices out of range.
+static bool DecodeEventBlock(const uint8_t* ptr, const uint8_t* end, size_t firstEvent, size_t eventsCount, size_t namesCount, BuildEvent* outEvents)
+{
+    const size_t n = std::min(firstEvent + kEventsPerBlock, eventsCount);
+    int64_t prevTs = 0;
+    for (size_t i = firstEvent; i != n; ++i)
+    {
+        if (ptr == end || *ptr >= kBuildEventTypeCount)
+            return false;
+        BuildEvent& ev = outEvents[i];
+        ev.type = BuildEventType(*ptr++);
+        uint64_t ts, dur, detail, parent;
+        if (!ReadVarint(ptr, end, ts) || !ReadVarint(ptr, end, dur) || !ReadVarint(ptr, end, detail) || !ReadVarint(ptr, end, parent))
+            return false;
+        ev.ts = prevTs + UnZigZag(ts);
+        ev.dur = UnZigZag(dur);
+        if (detail >= namesCount)
+            return false;
+        ev.detailIndex = DetailIndex(int(detail));
+        int64_t parentIndex = parent == 0 ? -1 : int64_t(i) + UnZigZag(parent);
+        if (parentIndex < -1 || parentIndex >= int64_t(eventsCount) || parentIndex == int64_t(i))
+            return false;
+        ev.parent = EventIndex(int(parentIndex));
+        prevTs = ev.ts;
+    }
+    return ptr == end;
+}
+
+// Events whose detail names are file paths.
+static bool HasPathDetail(BuildEventType type)
+{
+    return type == BuildEventType::kCompiler || type == BuildEventType::kFrontend || type == BuildEventType::kBackend
+        || type == BuildEventType::kParseFile || type == BuildEventType::kOptModule;
+}
+
+// Names as they are written into the data file; same layout as BuildNames, except that
+// the strings are not put into one block yet.
+struct NameTables
+{
+    struct Dir
+    {
+        int parent;
+        std::string_view name;
+    };
+    std::vector<Dir> dirs;
+    std::vector<int> nameDirs;
+    std::vector<std::string_view> nameLeaves;
+    std::vector<std::string_view> tokens;
+    std::vector<uint32_t> nameTokens;
+    std::vector<uint32_t> nameTokenStarts;
+
+    size_t size() const { return nameLeaves.size(); }
+};
+
+// Splits path names into a tree of directories plus file names, as stored in BuildNames.
+static void BuildPathTree(const BuildEvents& events, const std::vector<std::string_view>& names, NameTables& outNames)
+{
+    std::vector<bool> isPath(names.size(), false);
+    for (const auto& e : events)
+    {
+        if (HasPathDetail(e.type))
+            isPath[e.detailIndex.idx] = true;
+    }
+
+    ska::bytell_hash_map<std::string_view, int> dirToIndex;
+    std::vector<std::string_view> dirPaths;
+    outNames.dirs.clear();
+    outNames.nameDirs.resize(names.size());
+    outNames.nameLeaves.resize(names.size());
+    for (size_t i = 0, n = names.size(); i != n; ++i)
+    {
+        std::string_view name = names[i];
+        size_t slash = isPath[i] ? name.rfind('/') : std::string_view::npos;
+        if (slash == std::string_view::npos)
+        {
+            outNames.nameDirs[i] = -1;
+            outNames.nameLeaves[i] = name;
+            continue;
+        }
+        outNames.nameLeaves[i] = name.substr(slash + 1);
+
+        // find the directory; add it (and any missing parents) if it's not there yet
+        std::string_view dir = name.substr(0, slash);
+        dirPaths.clear();
+        int parent = -1;
+        while (true)
+        {
+            auto it = dirToIndex.find(dir);
+            if (it != dirToIndex.end())
+            {
+                parent = it->second;
+                break;
+            }
+            dirPaths.emplace_back(dir);
+            size_t dirSlash = dir.rfind('/');
+            if (dirSlash == std::string_view::npos)
+                break;
+            dir = dir.substr(0, dirSlash);
+        }
+        for (auto it = dirPaths.rbegin(); it != dirPaths.rend(); ++it)
+        {
+            size_t dirSlash = it->rfind('/');
+            NameTables::Dir d;
+            d.parent = parent;
+            d.name = dirSlash == std::string_view::npos ? *it : it->substr(dirSlash + 1);
+            parent = (int)outNames.dirs.size();
+            outNames.dirs.emplace_back(d);
+            dirToIndex.insert(std::make_pair(*it, parent));
+        }
+        outNames.nameDirs[i] = parent;
+    }
+}
+
+static bool IsIdentifierChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Splits a name into tokens: identifiers, "<" and ">" on their own, and runs of other characters.
+static void SplitNameTokens(std::string_view name, std::vector<std::string_view>& outTokens)
+{
+    size_t i = 0, n = name.size();
+    while (i < n)
+    {
+        size_t start = i;
+        char c = name[i];
+        if (IsIdentifierChar(c))
+        {
+            while (i < n && IsIdentifierChar(name[i]))
+                ++i;
+        }
+        else if (c == '<' || c == '>')
+            ++i;
+        else
+        {
+            while (i < n && !IsIdentifierChar(name[i]) && name[i] != '<' && name[i] != '>')
+                ++i;
+        }
+        outTokens.emplace_back(name.substr(start, i - start));
+    }
+}
+
+// Names shorter than this are not worth tokenizing.
+const size_t kTokenizeMinLength = 32;
+
+// Turns long names that are not paths into token sequences. Most frequent tokens go first
+// in the dictionary, so that they get the smallest (shortest to store) indices.
+static void TokenizeNames(NameTables& names)
+{
+    std::vector<std::string_view> nameTokens;
+    ska::bytell_hash_map<std::string_view, std::pair<uint32_t, uint32_t>> tokenCounts; // count, first use
+    for (size_t i = 0, n = names.size(); i != n; ++i)
+    {
+        if (names.nameDirs[i] != -1 || names.nameLeaves[i].size() < kTokenizeMinLength)
+            continue;
+        nameTokens.clear();
+        SplitNameTokens(names.nameLeaves[i], nameTokens);
+        for (std::string_view token : nameTokens)
+        {
+            auto res = tokenCounts.insert(std::make_pair(token, std::make_pair(0u, (uint32_t)tokenCounts.size())));
+            res.first->second.first++;
+        }
+    }
+    names.tokens.clear();
+    names.tokens.reserve(tokenCounts.size());
+    for (const auto& kvp : tokenCounts)
+        names.tokens.emplace_back(kvp.first);
+    std::sort(names.tokens.begin(), names.tokens.end(), [&](std::string_view a, std::string_view b)
+    {
+        const auto& ca = tokenCounts[a];
+        const auto& cb = tokenCounts[b];
+        if (ca.first != cb.first)
+            return ca.first > cb.first;
+        return ca.second < cb.second;
+    });
+    ska::bytell_hash_map<std::string_view, uint32_t> tokenToIndex;
+    for (size_t i = 0, n = names.tokens.size(); i != n; ++i)
+        tokenToIndex.insert(std::make_pair(names.tokens[i], (uint32_t)i));
+
+    names.nameTokens.clear();
+    names.nameTokenStarts.resize(names.size() + 1);
+    for (size_t i = 0, n = names.size(); i != n; ++i)
+    {
+        names.nameTokenStarts[i] = (uint32_t)names.nameTokens.size();
+        if (names.nameDirs[i] != -1 || names.nameLeaves[i].size() < kTokenizeMinLength)
+            continue;
+        nameTokens.clear();
+        SplitNameTokens(names.nameLeaves[i], nameTokens);
+        for (std::string_view token : nameTokens)
+            names.nameTokens.emplace_back(tokenToIndex[token]);
+        names.nameDirs[i] = BuildNames::kTokenized;
+        names.nameLeaves[i] = std::string_view();
+    }
+    names.nameTokenStarts[names.size()] = (uint32_t)names.nameTokens.size();
+}
+
+std::string_view BuildNames::String(const uint64_t* starts, uint64_t index) const
+{
+    uint64_t begin = starts[index];
+    uint64_t end = (std::min)(starts[index + 1], stringsSize);
+    if (begin >= end)
+        return std::string_view("");
+    // without the zero byte
+    return std::string_view(strings + begin, end - begin - 1);
+}
+
+int BuildNames::GetDir(DetailIndex index) const
+{
+    int dir = nameDirs[index.idx];
+    if (dir < kTokenized || (dir >= 0 && uint64_t(dir) >= dirsCount))
+        return -1;
+    return dir;
+}
+
+std::string_view BuildNames::GetDirPath(int dir) const
+{
+    if (dirPaths.size() != dirsCount)
+        dirPaths.resize(dirsCount);
+    if (dirPaths[dir].data() == nullptr)
+    {
+        int parent = dirParents[dir];
+        std::string_view name = String(dirNameStarts, dir);
+        // parents always go before their children
+        if (parent < 0 || parent >= dir)
+            dirPaths[dir] = name;
+        else
+        {
+            std::string_view parentPath = GetDirPath(parent);
+            size_t size = parentPath.size() + 1 + name.size();
+            char* ptr = (char*)ArenaAllocate(size + 1);
+            memcpy(ptr, parentPath.data(), parentPath.size());
+            ptr[parentPath.size()] = '/';
+            memcpy(ptr + parentPath.size() + 1, name.data(), name.size());
+            ptr[size] = 0;
+            dirPaths[dir] = std::string_view(ptr, size);
+        }
+    }
+    return dirPaths[dir];
+}
+
+std::string_view BuildNames::operator[](DetailIndex index) const
+{
+    int dir = GetDir(index);
+    if (dir == -1)
+        return String(nameLeafStarts, index.idx);
+    if (fullNames.size() != namesCount)
+        fullNames.resize(namesCount);
+    std::string_view& name = fullNames[index.idx];
+    if (name.data() == nullptr && dir == kTokenized)
+    {
+        size_t size = 0;
+        for (const uint32_t* t = TokensBegin(index), *tEnd = TokensEnd(index); t != tEnd; ++t)
+            size += Token(*t).size();
+        char* ptr = (char*)ArenaAllocate(size + 1);
+        name = std::string_view(ptr, size);
+        for (const uint32_t* t = TokensBegin(index), *tEnd = TokensEnd(index); t != tEnd; ++t)
+        {
+            std::string_view token = Token(*t);
+            memcpy(ptr, token.data(), token.size());
+            ptr += token.size();
+        }
+        *ptr = 0;
+    }
+    else if (name.data() == nullptr)
+    {
+        std::string_view dirPath = GetDirPath(dir);
+        std::string_view leaf = String(nameLeafStarts, index.idx);
+        size_t size = dirPath.size() + 1 + leaf.size();
+        char* ptr = (char*)ArenaAllocate(size + 1);
+        memcpy(ptr, dirPath.data(), dirPath.size());
+        ptr[dirPath.size()] = '/';
+        memcpy(ptr + dirPath.size() + 1, leaf.data(), leaf.size());
+        ptr[size] = 0;
+        name = std::string_view(ptr, size);
+    }
+    return name;
+}
+
+std::string_view BuildNames::GetFilename(DetailIndex index) const
+{
+    if (GetDir(index) >= 0)
+        return String(nameLeafStarts, index.idx);
+    return utils::GetFilename((*this)[index]);
+}
+
+// Goes over the text of a name piece by piece (tokens of tokenized names).
+struct NameTextCursor
+{
+    NameTextCursor(const BuildNames& names_, DetailIndex index)
+    : names(names_)
+    {
+        if (names.IsTokenized(index))
+        {
+            token = names.TokensBegin(index);
+            tokenEnd = names.TokensEnd(index);
+        }
+        else
+            piece = names[index];
+    }
+    // makes sure current piece is not empty; returns false at the end of the name
+    bool Fill()
+    {
+        while (piece.empty() && token != tokenEnd)
+            piece = names.Token(*token++);
+        return !piece.empty();
+    }
+    const BuildNames& names;
+    std::string_view piece;
+    const uint32_t* token = nullptr;
+    const uint32_t* tokenEnd = nullptr;
+};
+
+int BuildNames::Compare(DetailIndex a, DetailIndex b) const
+{
+    if (!IsTokenized(a) && !IsTokenized(b))
+        return (*this)[a].compare((*this)[b]);
+    NameTextCursor ca(*this, a), cb(*this, b);
+    while (true)
+    {
+        bool hasA = ca.Fill();
+        bool hasB = cb.Fill();
+        if (!hasA || !hasB)
+            return hasA ? 1 : (hasB ? -1 : 0);
+        size_t n = std::min(ca.piece.size(), cb.piece.size());
+        int res = ca.piece.substr(0, n).compare(cb.piece.substr(0, n));
+        if (res != 0)
+            return res;
+        ca.piece.remove_prefix(n);
+        cb.piece.remove_prefix(n);
+    }
+}
+
+uint32_t BeginMergeBuildEvents(BuildEventsParser* parser)
+{
+    return parser->BeginMerge();
+}
 
-bool SaveBuildEvents(BuildEventsParser* parser, const std::string& fileName)
+void MergeBuildEventsFile(BuildEventsParser* parser, uint32_t index)
 {
+    assert(parser->merged);
+    assert(index < parser->fileResults.size());
+    parser->MergeFile(index);
+}
+
+bool SaveBuildEvents(BuildEventsParser* parser, const std::string& fileName, bool compact)
+{
+    if (!parser->merged)
+    {
+        for (uint32_t i = 0, n = BeginMergeBuildEvents(parser); i != n; ++i)
+            MergeBuildEventsFile(parser, i);
+    }
+
     FILE* f = fopen(fileName.c_str(), "wb");
     if (f == nullptr)
     {
@@ -600,97 +2206,549 @@ bool SaveBuildEvents(BuildEventsParser* parser, const std::string& fileName)
 
     BufferedWriter w(f);
 
-    w.Write(kFileMagic);
-    int64_t eventsCount = parser->resultEvents.size();
-    w.Write(eventsCount);
-    for(const auto& e : parser->resultEvents)
+    // names: directories of the paths, the token dictionary, then each name with its
+    // directory, or its tokens
+    NameTables names;
+    BuildPathTree(parser->resultEvents, parser->resultNames, names);
+    TokenizeNames(names);
+
+    // where each string goes in the strings block; empty strings take no space
+    uint64_t stringsSize = 0;
+    auto AddStrings = [&stringsSize](size_t count, auto getString, std::vector<uint64_t>& outStarts)
+    {
+        outStarts.resize(count + 1);
+        for (size_t i = 0; i != count; ++i)
+        {
+            outStarts[i] = stringsSize;
+            size_t size = getString(i).size();
+            if (size != 0)
+                stringsSize += size + 1;
+        }
+        outStarts[count] = stringsSize;
+    };
+    std::vector<uint64_t> dirNameStarts, tokenStarts, nameLeafStarts;
+    AddStrings(names.dirs.size(), [&](size_t i) { return names.dirs[i].name; }, dirNameStarts);
+    AddStrings(names.tokens.size(), [&](size_t i) { return names.tokens[i]; }, tokenStarts);
+    AddStrings(names.size(), [&](size_t i) { return names.nameLeaves[i]; }, nameLeafStarts);
+
+    const BuildEvents& events = parser->resultEvents;
+    const BuildEventChildren& children = parser->resultChildren;
+    DataFileHeader header = {};
+    header.magic = kFileMagic;
+    header.eventsCount = events.size();
+    header.childrenCount = children.indices.size();
+    header.dirsCount = names.dirs.size();
+    header.tokensCount = names.tokens.size();
+    header.namesCount = names.size();
+    header.nameTokensCount = names.nameTokens.size();
+    header.stringsSize = stringsSize;
+    std::vector<uint8_t> eventBlocks;
+    if (compact)
     {
-        int32_t eType = (int32_t)e.type;
-        w.Write(eType);
-        w.Write(e.ts);
-        w.Write(e.dur);
-        w.Write(e.detailIndex.idx);
-        w.Write(e.parent.idx);
-        int64_t childCount = e.children.size();
-        w.Write(childCount);
-        w.Write(e.children.data(), childCount * sizeof(e.children[0]));
+        EncodeEventBlocks(events, eventBlocks);
+        header.flags |= kDataFileCompact;
+        header.childrenCount = 0;
+        header.eventBlocksSize = eventBlocks.size();
+        header.eventsHash = XXH64(eventBlocks.data(), eventBlocks.size(), 0);
+    }
+    else
+    {
+        XXH64_state_t* hasher = XXH64_createState();
+        XXH64_reset(hasher, 0);
+        XXH64_update(hasher, events.data(), events.size() * sizeof(BuildEvent));
+        XXH64_update(hasher, children.offsets.data(), children.offsets.size() * sizeof(uint32_t));
+        XXH64_update(hasher, children.indices.data(), children.indices.size() * sizeof(EventIndex));
+        header.eventsHash = XXH64_digest(hasher);
+        XXH64_freeState(hasher);
     }
 
-    int64_t namesCount = parser->resultNames.size();
-    w.Write(namesCount);
-    for(const auto& n : parser->resultNames)
+    const uint8_t kPadding[8] = {};
+    auto WritePart = [&w, &kPadding](const void* data, uint64_t size)
     {
-        uint32_t nSize = (uint32_t)n.size();
-        w.Write(nSize);
-        w.Write(n.data(), nSize);
+        w.Write(data, size);
+        w.Write(kPadding, AlignDataFilePart(size) - size);
+    };
+    w.Write(header);
+    if (compact)
+        WritePart(eventBlocks.data(), eventBlocks.size());
+    else
+    {
+        WritePart(events.data(), events.size() * sizeof(BuildEvent));
+        WritePart(children.offsets.data(), children.offsets.size() * sizeof(uint32_t));
+        WritePart(children.indices.data(), children.indices.size() * sizeof(EventIndex));
     }
+    std::vector<int32_t> dirParents(names.dirs.size());
+    for (size_t i = 0, n = names.dirs.size(); i != n; ++i)
+        dirParents[i] = names.dirs[i].parent;
+    WritePart(dirParents.data(), dirParents.size() * sizeof(int32_t));
+    WritePart(dirNameStarts.data(), dirNameStarts.size() * sizeof(uint64_t));
+    WritePart(tokenStarts.data(), tokenStarts.size() * sizeof(uint64_t));
+    WritePart(names.nameDirs.data(), names.nameDirs.size() * sizeof(int32_t));
+    WritePart(nameLeafStarts.data(), nameLeafStarts.size() * sizeof(uint64_t));
+    WritePart(names.nameTokenStarts.data(), names.nameTokenStarts.size() * sizeof(uint32_t));
+    WritePart(names.nameTokens.data(), names.nameTokens.size() * sizeof(uint32_t));
+    auto WriteStrings = [&w](size_t count, auto getString)
+    {
+        for (size_t i = 0; i != count; ++i)
+        {
+            std::string_view str = getString(i);
+            if (!str.empty())
+                w.Write(str.data(), str.size() + 1); // including the zero byte after it
+        }
+    };
+    WriteStrings(names.dirs.size(), [&](size_t i) { return names.dirs[i].name; });
+    WriteStrings(names.tokens.size(), [&](size_t i) { return names.tokens[i]; });
+    WriteStrings(names.size(), [&](size_t i) { return names.nameLeaves[i]; });
+    w.Write(kPadding, AlignDataFilePart(stringsSize) - stringsSize);
 
     return true;
 }
 
-bool LoadBuildEvents(const std::string& fileName, BuildEvents& outEvents, BuildNames& outNames)
+// Checks that parent indices of events (-1 for no parent) are in range, and that following
+// the parents always ends (there are no cycles), so that they can be followed without checks.
+// Parents can go before or after their children, so each event is walked up until an already
+// checked one; each event is visited once.
+template<typename GetParent>
+static bool CheckParentIndices(uint64_t eventsCount, GetParent getParent)
 {
-    FILE* f = fopen(fileName.c_str(), "rb");
-    if (f == nullptr)
+    enum : uint8_t { kNotChecked, kOnPath, kChecked };
+    std::vector<uint8_t> state(eventsCount, kNotChecked);
+    std::vector<int> path;
+    for (uint64_t i = 0; i != eventsCount; ++i)
     {
-        printf("%sERROR: failed to open file '%s'%s\n", col::kRed, fileName.c_str(), col::kReset);
-        return false;
+        int e = int(i);
+        path.clear();
+        while (e != -1 && state[e] == kNotChecked)
+        {
+            state[e] = kOnPath;
+            path.emplace_back(e);
+            int parent = getParent(e);
+            if (parent < -1 || int64_t(parent) >= int64_t(eventsCount))
+                return false;
+            e = parent;
+        }
+        if (e != -1 && state[e] == kOnPath)
+            return false;
+        for (int p : path)
+            state[p] = kChecked;
+    }
+    return true;
+}
+
+// Checks event types, parent and detail indices of a loaded data file, so that analysis can
+// use them without checks.
+static bool CheckEventIndices(const BuildEvent* events, uint64_t eventsCount, uint64_t namesCount)
+{
+    for (uint64_t i = 0; i != eventsCount; ++i)
+    {
+        if (int(events[i].type) < 0 || int(events[i].type) >= kBuildEventTypeCount)
+            return false;
+        if (events[i].detailIndex.idx < 0 || uint64_t(events[i].detailIndex.idx) >= namesCount)
+            return false;
     }
+    return CheckParentIndices(eventsCount, [&](int e) { return events[e].parent.idx; });
+}
 
-    BufferedReader r(f);
-    if (r.bufferSize < 12) // 4 bytes magic header, 8 bytes hash at end
+// Maps the whole file into memory for reading; returns null if that is not possible.
+static const uint8_t* MapFile(const std::string& fileName, size_t& outSize)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+    const void* ptr = nullptr;
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr)
+        {
+            // the view keeps the file mapped after the handles are closed
+            ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            outSize = size_t(size.QuadPart);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    return (const uint8_t*)ptr;
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    void* ptr = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        outSize = size_t(st.st_size);
+    }
+    close(fd);
+    return ptr == MAP_FAILED ? nullptr : (const uint8_t*)ptr;
+#endif
+}
+
+BuildEventsFile::~BuildEventsFile()
+{
+    if (data == nullptr)
+        return;
+    if (!mapped)
+    {
+        delete[] (const uint64_t*)data;
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, dataSize);
+#endif
+}
+
+bool LoadBuildEvents(enki::TaskScheduler& ts, const std::string& fileName, BuildEventsFile& outFile)
+{
+    outFile.data = MapFile(fileName, outFile.dataSize);
+    outFile.mapped = outFile.data != nullptr;
+    if (!outFile.mapped)
+    {
+        // read the file instead, into 8 byte aligned memory
+        FILE* f = fopen(fileName.c_str(), "rb");
+        if (f == nullptr)
+        {
+            printf("%sERROR: failed to open file '%s'%s\n", col::kRed, fileName.c_str(), col::kReset);
+            return false;
+        }
+        fseek(f, 0, SEEK_END);
+        int64_t fsize = ftello64(f);
+        fseek(f, 0, SEEK_SET);
+        outFile.dataSize = fsize > 0 ? size_t(fsize) : 0;
+        uint64_t* buffer = new uint64_t[outFile.dataSize / 8 + 1];
+        outFile.data = (const uint8_t*)buffer;
+        if (outFile.dataSize != 0 && fread(buffer, outFile.dataSize, 1, f) != 1)
+            outFile.dataSize = 0;
+        fclose(f);
+    }
+
+    const uint8_t* data = outFile.data;
+    const size_t dataSize = outFile.dataSize;
+    if (dataSize < sizeof(DataFileHeader) + sizeof(XXH64_hash_t)) // header, 8 bytes hash at end
     {
         printf("%sERROR: corrupt input file '%s' (size too small)%s\n", col::kRed, fileName.c_str(), col::kReset);
         return false;
     }
     // check header magic
-    int32_t magic = 0;
-    r.Read(magic);
-    if (magic != kFileMagic)
+    DataFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != kFileMagic)
     {
         printf("%sERROR: unknown format of input file '%s'%s\n", col::kRed, fileName.c_str(), col::kReset);
         return false;
     }
-    // chech hash checksum
-    XXH64_hash_t hash = XXH64(r.buffer, r.bufferSize-sizeof(XXH64_hash_t), 0);
-    if (memcmp(&hash, r.buffer+r.bufferSize-sizeof(XXH64_hash_t), sizeof(XXH64_hash_t)) != 0)
+    // check that the parts fit exactly into the file (with the counts being
+    // less than file size, the layout calculation can't overflow)
+    const uint64_t counts[] = { header.eventsCount, header.childrenCount, header.dirsCount, header.tokensCount, header.namesCount, header.nameTokensCount, header.stringsSize, header.eventBlocksSize };
+    for (uint64_t count : counts)
+    {
+        if (count >= dataSize)
+        {
+            printf("%sERROR: corrupt input file '%s' (size mismatch)%s\n", col::kRed, fileName.c_str(), col::kReset);
+            return false;
+        }
+    }
+    DataFileLayout layout = GetDataFileLayout(header);
+    if (layout.end != dataSize - sizeof(XXH64_hash_t))
+    {
+        printf("%sERROR: corrupt input file '%s' (size mismatch)%s\n", col::kRed, fileName.c_str(), col::kReset);
+        return false;
+    }
+    // check events checksum; the hash of the whole file at the end is not checked, since
+    // that would have to read all the names. Name tables are checked as they are used.
+    const bool compact = (header.flags & kDataFileCompact) != 0;
+    XXH64_hash_t hash;
+    if (compact)
+        hash = XXH64(data + layout.events, header.eventBlocksSize, 0);
+    else
+    {
+        XXH64_state_t* hasher = XXH64_createState();
+        XXH64_reset(hasher, 0);
+        XXH64_update(hasher, data + layout.events, header.eventsCount * sizeof(BuildEvent));
+        XXH64_update(hasher, data + layout.childOffsets, (header.eventsCount + 1) * sizeof(uint32_t));
+        XXH64_update(hasher, data + layout.childIndices, header.childrenCount * sizeof(EventIndex));
+        hash = XXH64_digest(hasher);
+        XXH64_freeState(hasher);
+    }
+    if (hash != header.eventsHash)
     {
         printf("%sERROR: corrupt input file '%s' (checksum mismatch)%s\n", col::kRed, fileName.c_str(), col::kReset);
         return false;
     }
+    const char* strings = (const char*)data + layout.strings;
+    if (header.stringsSize != 0 && strings[header.stringsSize - 1] != 0)
+    {
+        printf("%sERROR: corrupt input file '%s' (names)%s\n", col::kRed, fileName.c_str(), col::kReset);
+        return false;
+    }
 
-    int64_t eventsCount = 0;
-    r.Read(eventsCount);
-    outEvents.resize(eventsCount);
-    for(auto& e : outEvents)
+    outFile.eventsCount = header.eventsCount;
+    if (compact)
     {
-        int32_t eType;
-        r.Read(eType);
-        e.type = (BuildEventType)eType;
-        r.Read(e.ts);
-        r.Read(e.dur);
-        r.Read(e.detailIndex.idx);
-        r.Read(e.parent.idx);
-        int64_t childCount = 0;
-        r.Read(childCount);
-        e.children.resize(childCount);
-        if (childCount != 0)
-            r.Read(&e.children[0], childCount * sizeof(e.children[0]));
+        // decode the event blocks in parallel
+        const size_t blockCount = (header.eventsCount + kEventsPerBlock - 1) / kEventsPerBlock;
+        const size_t tableSize = blockCount * sizeof(uint64_t);
+        std::vector<uint64_t> blockEnds(blockCount);
+        bool valid = tableSize <= header.eventBlocksSize;
+        if (valid)
+            memcpy(blockEnds.data(), data + layout.events, tableSize);
+        for (size_t b = 0; valid && b != blockCount; ++b)
+            valid = blockEnds[b] >= (b == 0 ? 0 : blockEnds[b - 1]) && blockEnds[b] <= header.eventBlocksSize - tableSize;
+        std::atomic<bool> decoded(valid);
+        if (valid)
+        {
+            outFile.decodedEvents.resize(header.eventsCount);
+            const uint8_t* blocks = data + layout.events + tableSize;
+            enki::TaskSet task((uint32_t)blockCount, [&](enki::TaskSetPartition range, uint32_t)
+            {
+                for (auto b = range.start; b < range.end; ++b)
+                {
+                    const uint8_t* blockData = blocks + (b == 0 ? 0 : blockEnds[b - 1]);
+                    if (!DecodeEventBlock(blockData, blocks + blockEnds[b], b * kEventsPerBlock, header.eventsCount, header.namesCount, outFile.decodedEvents.data()))
+                        decoded = false;
+                }
+            });
+            ts.AddTaskSetToPipe(&task);
+            ts.WaitforTask(&task);
+        }
+        if (!decoded)
+        {
+            printf("%sERROR: corrupt input file '%s' (events)%s\n", col::kRed, fileName.c_str(), col::kReset);
+            return false;
+        }
+        outFile.events = outFile.decodedEvents.data();
+    }
+    else
+        outFile.events = (const BuildEvent*)(data + layout.events);
+    // analysis only needs the parent of each event, so the children are not used
+    if (!CheckEventIndices(outFile.events, header.eventsCount, header.namesCount))
+    {
+        printf("%sERROR: corrupt input file '%s' (events)%s\n", col::kRed, fileName.c_str(), col::kReset);
+        return false;
+    }
+
+    BuildNames& names = outFile.names;
+    names.strings = strings;
+    names.stringsSize = header.stringsSize;
+    names.dirsCount = header.dirsCount;
+    names.dirParents = (const int32_t*)(data + layout.dirParents);
+    names.dirNameStarts = (const uint64_t*)(data + layout.dirNameStarts);
+    names.tokensCount = header.tokensCount;
+    names.tokenStarts = (const uint64_t*)(data + layout.tokenStarts);
+    names.namesCount = header.namesCount;
+    names.nameDirs = (const int32_t*)(data + layout.nameDirs);
+    names.nameLeafStarts = (const uint64_t*)(data + layout.nameLeafStarts);
+    names.nameTokensCount = header.nameTokensCount;
+    names.nameTokens = (const uint32_t*)(data + layout.nameTokens);
+    names.nameTokenStarts = (const uint32_t*)(data + layout.nameTokenStarts);
+    return true;
+}
+
+// Are the indices of cached events in range, do the children match the parents, and
+// do the parents have no cycles?
+static bool IsValidCachedFile(const CachedFileEvents& cached, int64_t namesCount)
+{
+    const int64_t n = int64_t(cached.events.size());
+    uint64_t childrenCount = 0;
+    for (const CachedEvent& cev : cached.events)
+    {
+        if (cev.detailIndex < 0 || cev.detailIndex >= namesCount || cev.type < 0 || cev.type >= kBuildEventTypeCount)
+            return false;
+        childrenCount += cev.childCount;
+    }
+    if (childrenCount != cached.children.size())
+        return false;
+    size_t childPos = 0;
+    for (int64_t i = 0; i != n; ++i)
+    {
+        for (uint32_t j = 0; j != cached.events[i].childCount; ++j)
+        {
+            int32_t child = cached.children[childPos++];
+            if (child < 0 || child >= n || cached.events[child].parent != i)
+                return false;
+        }
     }
+    return CheckParentIndices(n, [&](int e) { return cached.events[e].parent; });
+}
 
+const uint32_t kCacheFileMagic = 0x43424143; // 'CBAC'
+const uint32_t kCacheFileVersion = 2; // change whenever parsed events for the same input would change
+
+bool LoadBuildEventsCache(BuildEventsParser* parser, const std::string& fileName)
+{
+    parser->useCache = true;
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+
+    BufferedReader r(f);
+    if (r.bufferSize < 16)
+        return false;
+    // an unknown or corrupt cache is not an error, all files are just parsed again
+    uint32_t magic = 0, version = 0;
+    r.Read(magic);
+    r.Read(version);
+    if (magic != kCacheFileMagic || version != kCacheFileVersion)
+        return false;
+    XXH64_hash_t hash = XXH64(r.buffer, r.bufferSize-sizeof(XXH64_hash_t), 0);
+    if (memcmp(&hash, r.buffer+r.bufferSize-sizeof(XXH64_hash_t), sizeof(XXH64_hash_t)) != 0)
+    {
+        printf("%sWARN: ignoring corrupt ingest cache file '%s'%s\n", col::kYellow, fileName.c_str(), col::kReset);
+        return false;
+    }
+
+    // counts are checked against the bytes left (each name is at least its size, each file
+    // at least its path size and fixed fields), so that a bad one does not allocate a lot
     int64_t namesCount = 0;
     r.Read(namesCount);
-    outNames.resize(namesCount);
-    for(auto& n : outNames)
+    if (namesCount < 0 || uint64_t(namesCount) > r.Left() / sizeof(uint32_t))
+        return false;
+    parser->cacheInNames.resize(namesCount);
+    for (auto& n : parser->cacheInNames)
     {
         uint32_t nSize = 0;
         r.Read(nSize);
+        if (nSize > r.Left())
+        {
+            parser->cacheInNames.clear();
+            return false;
+        }
         char* ptr = (char*)ArenaAllocate(nSize+1);
         memset(ptr, 0, nSize+1);
         n = std::string_view(ptr, nSize);
-        if (nSize != 0)
-            r.Read(ptr, nSize);
+        r.Read(ptr, nSize);
+    }
+    parser->cacheInNameToResult.reset(new std::atomic<int>[namesCount]);
+    for (int64_t i = 0; i < namesCount; ++i)
+        parser->cacheInNameToResult[i] = 0;
+
+    int64_t filesCount = 0;
+    r.Read(filesCount);
+    const size_t kMinFileSize = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(int64_t) + sizeof(uint64_t) + sizeof(uint8_t) + 2 * sizeof(uint64_t);
+    if (filesCount < 0 || uint64_t(filesCount) > r.Left() / kMinFileSize)
+    {
+        parser->cacheInNames.clear();
+        return false;
+    }
+    parser->cacheIn.reserve(filesCount);
+    std::string path;
+    for (int64_t i = 0; i < filesCount; ++i)
+    {
+        uint32_t pathSize = 0;
+        r.Read(pathSize);
+        if (pathSize > r.Left())
+        {
+            parser->cacheIn.clear();
+            return false;
+        }
+        path.resize(pathSize);
+        r.Read(path.data(), pathSize);
+        CachedFileEvents& cached = parser->cacheIn[path];
+        r.Read(cached.size);
+        r.Read(cached.modTime);
+        r.Read(cached.hash);
+        uint8_t isTrace = 0;
+        r.Read(isTrace);
+        cached.isTrace = isTrace != 0;
+        uint64_t eventsCount = 0, childrenCount = 0;
+        r.Read(eventsCount);
+        r.Read(childrenCount);
+        if (eventsCount > r.Left() / sizeof(CachedEvent) || childrenCount > (r.Left() - eventsCount * sizeof(CachedEvent)) / sizeof(int32_t))
+        {
+            parser->cacheIn.clear();
+            return false;
+        }
+        cached.events.resize(eventsCount);
+        r.Read(cached.events.data(), eventsCount * sizeof(CachedEvent));
+        cached.children.resize(childrenCount);
+        r.Read(cached.children.data(), childrenCount * sizeof(int32_t));
+        // a file with bad indices (e.g. a stale or damaged cache) is just parsed again
+        if (!IsValidCachedFile(cached, namesCount))
+            parser->cacheIn.erase(path);
+    }
+    return true;
+}
+
+bool SaveBuildEventsCache(BuildEventsParser* parser, const std::string& fileName)
+{
+    // nothing to do if all the files were taken from the cache as is
+    if (!parser->cacheChanged && parser->cacheOut.size() == parser->cacheIn.size())
+        return true;
+
+    // names table of the files that are kept; for each file, remap its detail indices into it
+    std::vector<std::string_view> names;
+    ska::bytell_hash_map<std::string_view, int32_t> nameToIndex;
+    std::vector<int32_t> cacheInNameRemap(parser->cacheInNames.size(), -1);
+    std::vector<int32_t> parsedNameRemap(parser->names.Size(), -1);
+    names.emplace_back();
+    nameToIndex.insert(std::make_pair(names.back(), 0));
+    auto AddName = [&](std::string_view name)
+    {
+        auto res = nameToIndex.insert(std::make_pair(name, (int32_t)names.size()));
+        if (res.second)
+            names.emplace_back(name);
+        return res.first->second;
+    };
+    for (const auto& kvp : parser->cacheOut)
+    {
+        const CachedFileEvents& cached = kvp.second;
+        for (const CachedEvent& cev : cached.events)
+        {
+            if (cached.parsedNames && parsedNameRemap[cev.detailIndex] < 0)
+                parsedNameRemap[cev.detailIndex] = AddName(parser->names[DetailIndex(cev.detailIndex)]);
+            else if (!cached.parsedNames && cacheInNameRemap[cev.detailIndex] < 0)
+                cacheInNameRemap[cev.detailIndex] = AddName(parser->cacheInNames[cev.detailIndex]);
+        }
+    }
+
+    FILE* f = fopen(fileName.c_str(), "wb");
+    if (f == nullptr)
+    {
+        printf("%sWARN: failed to save ingest cache to file '%s'%s\n", col::kYellow, fileName.c_str(), col::kReset);
+        return false;
+    }
+
+    BufferedWriter w(f);
+    w.Write(kCacheFileMagic);
+    w.Write(kCacheFileVersion);
+    int64_t namesCount = names.size();
+    w.Write(namesCount);
+    for (const auto& n : names)
+    {
+        uint32_t nSize = (uint32_t)n.size();
+        w.Write(nSize);
+        w.Write(n.data(), nSize);
     }
 
+    int64_t filesCount = parser->cacheOut.size();
+    w.Write(filesCount);
+    for (const auto& kvp : parser->cacheOut)
+    {
+        uint32_t pathSize = (uint32_t)kvp.first.size();
+        w.Write(pathSize);
+        w.Write(kvp.first.data(), pathSize);
+        const CachedFileEvents& cached = kvp.second;
+        w.Write(cached.size);
+        w.Write(cached.modTime);
+        w.Write(cached.hash);
+        uint8_t isTrace = cached.isTrace ? 1 : 0;
+        w.Write(isTrace);
+        uint64_t eventsCount = cached.events.size();
+        uint64_t childrenCount = cached.children.size();
+        w.Write(eventsCount);
+        w.Write(childrenCount);
+        const std::vector<int32_t>& remap = cached.parsedNames ? parsedNameRemap : cacheInNameRemap;
+        for (CachedEvent cev : cached.events)
+        {
+            cev.detailIndex = remap[cev.detailIndex];
+            w.Write(cev);
+        }
+        w.Write(cached.children.data(), childrenCount * sizeof(int32_t));
+    }
     return true;
 }
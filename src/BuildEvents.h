@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: Unlicense
 #pragma once
 #define _CRT_SECURE_NO_WARNINGS
+#include <algorithm>
 #include <stdint.h>
 #include <string>
 #include <string_view>
@@ -15,6 +16,8 @@
 #define ftello64 ftello
 #endif
 
+namespace enki { class TaskScheduler; }
+
 
 enum class BuildEventType
 {
@@ -30,7 +33,9 @@ enum class BuildEventType
     kInstantiateFunction,
     kOptModule,
     kOptFunction,
+    kOther, // summed time of pruned events under one parent; not in any per-name report
 };
+const int kBuildEventTypeCount = int(BuildEventType::kOther) + 1;
 
 struct DetailIndex
 {
@@ -74,16 +79,17 @@ namespace std
     };
 }
 
+// Fixed size event record; children of the events are kept separately, in BuildEventChildren.
 struct BuildEvent
 {
-    BuildEventType type = BuildEventType::kUnknown;
     int64_t ts = 0;
     int64_t dur = 0;
     DetailIndex detailIndex;
     EventIndex parent{ -1 };
-    char phase = 0;
-    std::vector<EventIndex> children;
+    BuildEventType type = BuildEventType::kUnknown;
+    int32_t phase = 0; // only used while parsing
 };
+static_assert(sizeof(BuildEvent) == 32, "BuildEvent is written to data file as is");
 
 template <typename T, typename Idx>
 struct IndexedVector : std::vector<T>
@@ -92,16 +98,176 @@ struct IndexedVector : std::vector<T>
     typename std::vector<T>::reference       operator[](Idx pos) { return this->begin()[pos.idx]; }
     typename std::vector<T>::const_reference operator[](Idx pos) const { return this->begin()[pos.idx]; }
 };
-typedef IndexedVector<std::string_view, DetailIndex> BuildNames;
 typedef IndexedVector<BuildEvent, EventIndex> BuildEvents;
 
+// Children of build events, in compressed sparse row form: children of event i are
+// indices[offsets[i]] .. indices[offsets[i+1]-1], in the order of their start time.
+struct BuildEventChildren
+{
+    std::vector<uint32_t> offsets; // one more than there are events
+    std::vector<EventIndex> indices;
+
+    const EventIndex* Begin(EventIndex e) const { return indices.data() + offsets[e.idx]; }
+    const EventIndex* End(EventIndex e) const { return indices.data() + offsets[e.idx + 1]; }
+    uint32_t Count(EventIndex e) const { return offsets[e.idx + 1] - offsets[e.idx]; }
+};
+
+// Names of build events (indexed by DetailIndex). Names that are file paths are stored as
+// a tree of directories plus the file name, since most of them share long directory prefixes.
+// Long names (templates, functions) are stored as sequences of tokens (identifiers, "<", ">" and
+// runs of other characters) from a shared dictionary. Full strings are only built when asked for.
+// The tables are used in place from the loaded data file: all strings are in one block, and the
+// tables have offsets into it, so nothing has to be done for each name when loading. Out of range
+// offsets and indices (from a corrupt file) read as empty strings.
+// NOTE: not thread safe
+struct BuildNames
+{
+    static const int kTokenized = -2;
+
+    // all the strings, each followed by a zero byte; string i of a table
+    // with "starts" offsets is at strings + starts[i], up to starts[i+1]
+    const char* strings = nullptr;
+    uint64_t stringsSize = 0;
+    // directories: parent directory (-1 for top level directories; full directory
+    // path is parent path + "/" + name) and name
+    uint64_t dirsCount = 0;
+    const int32_t* dirParents = nullptr;
+    const uint64_t* dirNameStarts = nullptr; // dirsCount+1 entries
+    // token dictionary
+    uint64_t tokensCount = 0;
+    const uint64_t* tokenStarts = nullptr; // tokensCount+1 entries
+    // names: directory of each name (-1 for names that are not paths, kTokenized for tokenized names),
+    // file name for paths, whole name for others, empty for tokenized names
+    uint64_t namesCount = 0;
+    const int32_t* nameDirs = nullptr;
+    const uint64_t* nameLeafStarts = nullptr; // namesCount+1 entries
+    // tokens of all the tokenized names, and where tokens of each name start in them
+    uint64_t nameTokensCount = 0;
+    const uint32_t* nameTokens = nullptr;
+    const uint32_t* nameTokenStarts = nullptr; // namesCount+1 entries
+
+    size_t size() const { return namesCount; }
+    bool IsTokenized(DetailIndex index) const { return nameDirs[index.idx] == kTokenized; }
+    const uint32_t* TokensBegin(DetailIndex index) const { return nameTokens + (std::min)(uint64_t(nameTokenStarts[index.idx]), nameTokensCount); }
+    const uint32_t* TokensEnd(DetailIndex index) const { return (std::max)(TokensBegin(index), nameTokens + (std::min)(uint64_t(nameTokenStarts[index.idx + 1]), nameTokensCount)); }
+    std::string_view Token(uint32_t token) const { return token < tokensCount ? String(tokenStarts, token) : std::string_view(); }
+    // full name
+    std::string_view operator[](DetailIndex index) const;
+    // file name part (without directory) of the name
+    std::string_view GetFilename(DetailIndex index) const;
+    // compares the full names, without building them
+    int Compare(DetailIndex a, DetailIndex b) const;
+
+private:
+    mutable std::vector<std::string_view> fullNames; // built on demand
+    mutable std::vector<std::string_view> dirPaths; // built on demand
+    std::string_view String(const uint64_t* starts, uint64_t index) const;
+    int GetDir(DetailIndex index) const;
+    std::string_view GetDirPath(int dir) const;
+};
+
 struct BuildEventsParser;
-BuildEventsParser* CreateBuildEventsParser();
+// threadCount: how many threads will be calling ParseBuildEvents; each of them
+// gets its own reusable parsing buffers.
+BuildEventsParser* CreateBuildEventsParser(uint32_t threadCount);
 void DeleteBuildEventsParser(BuildEventsParser* parser);
 
-// NOTE: can be called in parallel
-bool ParseBuildEvents(BuildEventsParser* parser, const std::string& fileName);
+// Ingest-time pruning of events, for traces that have lots of tiny events (e.g. with a fine
+// -ftime-trace-granularity). Pruned events are not kept; their time stays in their parent's
+// duration, and is also summed into one kOther event under that parent. Parse events of
+// headers are still kept when something under them is kept, so that include chains do not
+// change. Other children of pruned events that are not pruned themselves are moved to the parent.
+struct BuildEventsPruning
+{
+    // events of each type shorter than this many microseconds are pruned
+    int64_t minDurationUs[kBuildEventTypeCount] = {};
+    // glob patterns (* and ? wildcards) of trace file paths; files that do not match
+    // the include patterns (if there are any), or match the exclude ones, are skipped
+    std::vector<std::string> includeUnits;
+    std::vector<std::string> excludeUnits;
+    // same, for header paths; parse events of the headers that don't pass are pruned
+    std::vector<std::string> includeHeaders;
+    std::vector<std::string> excludeHeaders;
+};
+// Needs to be set before any parsing is done.
+void SetBuildEventsPruning(BuildEventsParser* parser, const BuildEventsPruning& pruning);
+
+// modTime: file modification time, only used as ingest cache key.
+// NOTE: can be called in parallel, as long as each concurrent call
+// passes a different threadIndex (< threadCount passed at creation).
+bool ParseBuildEvents(BuildEventsParser* parser, const std::string& fileName, int64_t modTime, uint32_t threadIndex);
+
+// JSON data in memory passed to ParseBuildEvents has to be followed by
+// at least this many readable bytes.
+const size_t kJsonPadding = 64;
+
+// Same as above, but for JSON file contents already loaded into memory.
+bool ParseBuildEvents(BuildEventsParser* parser, const std::string& fileName, int64_t modTime, const char* data, size_t size, uint32_t threadIndex);
+
+// Trace files are reported as the object files next to them (.o or .obj), when those exist.
+// Directories get listed (once each) to find them; the ones already listed while finding
+// the trace files can be passed here before parsing, so they are not listed again.
+// dirPath: with forward slashes and a trailing slash; objectFiles: .o/.obj file names in it.
+void AddKnownObjectFiles(BuildEventsParser* parser, const std::string& dirPath, std::vector<std::string>& objectFiles);
+
+// Incremental ingest: parsed events of each file can be kept in a cache file between
+// runs, keyed by file path, size, modification time and contents hash. Files found in
+// the cache are not parsed again. Once the cache is loaded (even if the file does not
+// exist yet), ParseBuildEvents calls also put results into it.
+bool LoadBuildEventsCache(BuildEventsParser* parser, const std::string& fileName);
+// Saves the cache, with entries of the files seen in this run only.
+bool SaveBuildEventsCache(BuildEventsParser* parser, const std::string& fileName);
+// Does the cache have events of the file with this size and modification time?
+bool IsBuildEventsFileCached(BuildEventsParser* parser, const std::string& fileName, uint64_t size, int64_t modTime);
+// Adds events of the file from the cache, as if it was parsed. Returns false when not
+// in the cache, or when the cached file is not a trace file.
+// NOTE: can be called in parallel, for different files.
+bool ParseCachedBuildEvents(BuildEventsParser* parser, const std::string& fileName, uint64_t size, int64_t modTime);
+
+// Parsing of one large file, split into chunks that are parsed in parallel:
+// - BeginSplitBuildEvents reads the file and finds the chunks (approximately chunkCount of them),
+// - ParseSplitBuildEventsChunk is called for each chunk (can be called in parallel, with different
+//   threadIndex for each concurrent call, same as ParseBuildEvents),
+// - EndSplitBuildEvents combines the results; returns same as ParseBuildEvents would.
+// If a file can't be split, it is parsed fully in BeginSplitBuildEvents, and the chunk count is zero.
+// NOTE: no other parsing can be done while chunks of a file are parsed.
+struct BuildEventsSplit;
+BuildEventsSplit* BeginSplitBuildEvents(BuildEventsParser* parser, const std::string& fileName, int64_t modTime, uint32_t chunkCount);
+uint32_t GetSplitBuildEventsChunkCount(BuildEventsSplit* split);
+void ParseSplitBuildEventsChunk(BuildEventsSplit* split, uint32_t chunkIndex, uint32_t threadIndex);
+bool EndSplitBuildEvents(BuildEventsSplit* split);
 
-bool SaveBuildEvents(BuildEventsParser* parser, const std::string& fileName);
+// Once all files are parsed, their events are merged into the final result, in order of
+// file names, so that the result does not depend on which thread parsed which file:
+// - BeginMergeBuildEvents orders the files and figures out where their events go; returns file count,
+// - MergeBuildEventsFile moves the events of each file into place (can be called in parallel).
+// SaveBuildEvents does the merge itself, if that was not done before.
+uint32_t BeginMergeBuildEvents(BuildEventsParser* parser);
+void MergeBuildEventsFile(BuildEventsParser* parser, uint32_t index);
+
+// Compact data files have delta/varint encoded events, and no children; they take much less
+// space, but events have to be decoded when loading.
+bool SaveBuildEvents(BuildEventsParser* parser, const std::string& fileName, bool compact);
+
+// Data file loaded for analysis. The file is mapped into memory (or read, where it can't be
+// mapped), and its events and names are used in place from there. Events of compact data
+// files are decoded into decodedEvents.
+struct BuildEventsFile
+{
+    const BuildEvent* events = nullptr;
+    size_t eventsCount = 0;
+    BuildNames names;
+    BuildEvents decodedEvents;
+
+    BuildEventsFile() = default;
+    BuildEventsFile(const BuildEventsFile&) = delete;
+    BuildEventsFile& operator=(const BuildEventsFile&) = delete;
+    ~BuildEventsFile();
+
+    // file contents
+    const uint8_t* data = nullptr;
+    size_t dataSize = 0;
+    bool mapped = false;
+};
 
-bool LoadBuildEvents(const std::string& fileName, BuildEvents& outEvents, BuildNames& outNames);
+bool LoadBuildEvents(enki::TaskScheduler& ts, const std::string& fileName, BuildEventsFile& outFile);
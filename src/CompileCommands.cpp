@@ -0,0 +1,297 @@
+// Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
+// SPDX-License-Identifier: Unlicense
+#include "CompileCommands.h"
+
+#include "Colors.h"
+#include "Utils.h"
+#include "external/simdjson/simdjson.h"
+#include <algorithm>
+#include <string.h>
+#include <sys/stat.h>
+
+static bool IsDirectory(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+static bool IsSeparator(char c)
+{
+    return c == '/' || c == '\\';
+}
+
+static bool IsAbsolutePath(const std::string& path)
+{
+    return (!path.empty() && IsSeparator(path[0])) || (path.size() > 1 && path[1] == ':');
+}
+
+// Makes path absolute relative to dir, uses forward slashes and removes "." and ".." parts.
+static std::string MakeAbsolutePath(const std::string& dir, const std::string& path)
+{
+    std::string full = IsAbsolutePath(path) ? path : dir + "/" + path;
+    std::replace(full.begin(), full.end(), '\\', '/');
+
+    // keep the root part as is ("/", "//server" or "C:/")
+    size_t pos = 0;
+    if (full.size() > 1 && full[1] == ':')
+        pos = 2;
+    while (pos < full.size() && full[pos] == '/')
+        ++pos;
+    std::string res = full.substr(0, pos);
+
+    std::vector<std::string_view> parts;
+    while (pos < full.size())
+    {
+        size_t end = full.find('/', pos);
+        if (end == std::string::npos)
+            end = full.size();
+        std::string_view part(full.data() + pos, end - pos);
+        if (part == ".." && !parts.empty() && parts.back() != "..")
+            parts.pop_back();
+        else if (!part.empty() && part != ".")
+            parts.emplace_back(part);
+        pos = end + 1;
+    }
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        if (i != 0)
+            res += '/';
+        res += parts[i];
+    }
+    return res;
+}
+
+// Same as llvm::sys::path::replace_extension: "dir/foo.cpp.o" -> "dir/foo.cpp.json"
+static std::string ReplaceExtension(const std::string& path, const char* ext)
+{
+    size_t nameStart = path.find_last_of("/\\");
+    nameStart = nameStart == std::string::npos ? 0 : nameStart + 1;
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || dot <= nameStart)
+        return path + ext;
+    return path.substr(0, dot) + ext;
+}
+
+// Case sensitive, unlike utils::BeginsWith: compiler options like -o and -O differ only by case.
+static bool HasPrefix(const std::string& str, const char* prefix)
+{
+    return str.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// Splits the "command" string into arguments, the same way clang tooling does.
+static void SplitCommandLine(std::string_view cmd, std::vector<std::string>& outArgs)
+{
+    std::string arg;
+    bool inArg = false;
+    bool inQuotes = false;
+    for (size_t i = 0; i < cmd.size(); ++i)
+    {
+        char c = cmd[i];
+        if (!inQuotes && (c == ' ' || c == '\t' || c == '\r' || c == '\n'))
+        {
+            if (inArg)
+                outArgs.emplace_back(arg);
+            arg.clear();
+            inArg = false;
+            continue;
+        }
+        inArg = true;
+#ifdef _WIN32
+        // Windows rules: backslashes are literal, unless they are followed by a quote
+        if (c == '\\')
+        {
+            size_t count = 0;
+            while (i < cmd.size() && cmd[i] == '\\')
+            {
+                ++count;
+                ++i;
+            }
+            if (i < cmd.size() && cmd[i] == '"')
+            {
+                arg.append(count / 2, '\\');
+                if (count & 1)
+                    arg += '"';
+                else
+                    inQuotes = !inQuotes;
+            }
+            else
+            {
+                arg.append(count, '\\');
+                --i;
+            }
+        }
+        else if (c == '"')
+            inQuotes = !inQuotes;
+        else
+            arg += c;
+#else
+        // POSIX shell rules
+        if (c == '\\' && i + 1 < cmd.size())
+        {
+            if (!inQuotes || cmd[i + 1] == '"' || cmd[i + 1] == '\\')
+                ++i;
+            arg += cmd[i];
+        }
+        else if (c == '"')
+            inQuotes = !inQuotes;
+        else if (c == '\'' && !inQuotes)
+        {
+            size_t end = cmd.find('\'', i + 1);
+            if (end == std::string_view::npos)
+                end = cmd.size();
+            arg.append(cmd.substr(i + 1, end - i - 1));
+            i = end;
+        }
+        else
+            arg += c;
+#endif
+    }
+    if (inArg)
+        outArgs.emplace_back(arg);
+}
+
+static bool ParseEntry(const simdjson::dom::object& entry, const std::string& dbDir, CompileCommandTrace& outTrace)
+{
+    std::string_view dirView, fileView;
+    if (entry["directory"].get_string().get(dirView) || entry["file"].get_string().get(fileView))
+        return false;
+    // relative directory is relative to where the database is, same as in clang tooling
+    std::string dir = MakeAbsolutePath(dbDir, std::string(dirView));
+    std::string file(fileView);
+
+    std::vector<std::string> args;
+    simdjson::dom::array argsArray;
+    std::string_view command;
+    if (!entry["arguments"].get_array().get(argsArray))
+    {
+        for (auto arg : argsArray)
+        {
+            std::string_view str;
+            if (!arg.get_string().get(str))
+                args.emplace_back(str);
+        }
+    }
+    else if (!entry["command"].get_string().get(command))
+        SplitCommandLine(command, args);
+    else
+        return false;
+
+    // find the object file path, and the -ftime-trace path if it was given
+    bool clangCl = false;
+    if (!args.empty())
+    {
+        std::string compiler(utils::GetFilename(args[0]));
+        utils::Lowercase(compiler);
+        clangCl = compiler == "clang-cl" || compiler == "clang-cl.exe" || compiler == "cl.exe";
+    }
+    std::string output, tracePath;
+    for (size_t i = 1; i < args.size(); ++i)
+    {
+        std::string arg = args[i];
+        if (HasPrefix(arg, "/clang:") || HasPrefix(arg, "-clang:"))
+            arg = arg.substr(7);
+
+        if (arg == "-o" && i + 1 < args.size())
+            output = args[++i];
+        else if (HasPrefix(arg, "--output="))
+            output = arg.substr(9);
+        else if (arg.size() > 2 && HasPrefix(arg, "-o") && !HasPrefix(arg, "-obj"))
+            output = arg.substr(2);
+        else if ((clangCl && HasPrefix(arg, "/Fo")) || HasPrefix(arg, "-Fo"))
+        {
+            // /Fo<path>, /Fo:<path>, /Fo: <path>; a path ending with a slash is a directory
+            output = arg.substr(arg.size() > 3 && arg[3] == ':' ? 4 : 3);
+            if (output.empty() && i + 1 < args.size())
+                output = args[++i];
+            if (!output.empty() && IsSeparator(output.back()))
+                output += ReplaceExtension(std::string(utils::GetFilename(file)), ".obj");
+            clangCl = true;
+        }
+        else if (HasPrefix(arg, "-ftime-trace="))
+            tracePath = arg.substr(13);
+        else if (arg == "--driver-mode=cl")
+            clangCl = true;
+    }
+    std::string_view outputView;
+    if (!entry["output"].get_string().get(outputView))
+        output = outputView;
+    if (output.empty())
+        output = ReplaceExtension(std::string(utils::GetFilename(file)), clangCl ? ".obj" : ".o");
+    output = MakeAbsolutePath(dir, output);
+
+    // by default the trace file is next to the object file; with -ftime-trace=<path> it goes
+    // into that file, or into that directory with the object file name
+    if (tracePath.empty())
+        outTrace.tracePath = ReplaceExtension(output, ".json");
+    else
+    {
+        bool isDir = IsSeparator(tracePath.back());
+        tracePath = MakeAbsolutePath(dir, tracePath);
+        if (isDir || IsDirectory(tracePath))
+            tracePath += "/" + ReplaceExtension(std::string(utils::GetFilename(output)), ".json");
+        outTrace.tracePath = tracePath;
+    }
+    outTrace.sourceFile = MakeAbsolutePath(dir, file);
+    return true;
+}
+
+bool ReadCompileCommands(const std::string& dbPath, std::vector<CompileCommandTrace>& outTraces)
+{
+    simdjson::dom::parser parser;
+    simdjson::dom::element doc;
+    simdjson::dom::array entries;
+    auto err = parser.load(dbPath).get(doc);
+    if (!err)
+        err = doc.get_array().get(entries);
+    if (err)
+    {
+        printf("%sERROR: failed to read compilation database '%s': %s.%s\n", col::kRed, dbPath.c_str(), simdjson::error_message(err), col::kReset);
+        return false;
+    }
+
+    size_t slash = dbPath.find_last_of("/\\");
+    std::string dbDir = slash == std::string::npos ? "." : dbPath.substr(0, slash);
+    size_t invalid = 0;
+    for (auto entry : entries)
+    {
+        simdjson::dom::object obj;
+        CompileCommandTrace trace;
+        if (!entry.get_object().get(obj) && ParseEntry(obj, dbDir, trace))
+            outTraces.emplace_back(trace);
+        else
+            ++invalid;
+    }
+    if (invalid != 0)
+        printf("%sWARN: skipped %zu invalid entries in compilation database '%s'.%s\n", col::kYellow, invalid, dbPath.c_str(), col::kReset);
+    return true;
+}
+
+// Does the file start like a compilation database, i.e. an array of objects with
+// "directory" / "file" keys? Trace files are objects, or arrays of events without those.
+static bool LooksLikeCompileCommands(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+    char buffer[4096];
+    size_t size = fread(buffer, 1, sizeof(buffer), f);
+    fclose(f);
+    std::string_view text(buffer, size);
+    size_t pos = text.find_first_not_of(" \t\r\n");
+    if (pos == std::string_view::npos || text[pos] != '[')
+        return false;
+    pos = text.find_first_not_of(" \t\r\n", pos + 1);
+    if (pos == std::string_view::npos || text[pos] != '{')
+        return false;
+    // keys of the first entry
+    std::string_view entry = text.substr(pos, text.find('}', pos) - pos);
+    return entry.find("\"directory\"") != std::string_view::npos && entry.find("\"file\"") != std::string_view::npos;
+}
+
+bool IsCompileCommandsFile(const std::string& path)
+{
+    struct stat st;
+    if (!utils::EndsWith(path, ".json") || stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+        return false;
+    return utils::GetFilename(path) == "compile_commands.json" || LooksLikeCompileCommands(path);
+}
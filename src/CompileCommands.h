@@ -0,0 +1,21 @@
+// Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
+// SPDX-License-Identifier: Unlicense
+#pragma once
+#include <string>
+#include <vector>
+
+struct CompileCommandTrace
+{
+    std::string sourceFile; // absolute path of the compiled file
+    std::string tracePath;  // absolute path where clang -ftime-trace writes the trace for it
+};
+
+// Reads a compilation database (compile_commands.json) and figures out, for each
+// entry, where clang writes its -ftime-trace .json file: next to the object file
+// (or into -ftime-trace=<path> if that is used). Relative entry directories are
+// relative to the database location.
+bool ReadCompileCommands(const std::string& dbPath, std::vector<CompileCommandTrace>& outTraces);
+
+// Is the path a compilation database: a compile_commands.json file, or another .json file
+// that starts like one (as opposed to an artifacts directory, or a single trace file)?
+bool IsCompileCommandsFile(const std::string& path);
@@ -0,0 +1,224 @@
+// Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
+// SPDX-License-Identifier: Unlicense
+#include "ReadAhead.h"
+
+#include "BuildEvents.h"
+#include <algorithm>
+#include <assert.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <stdio.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct ReadAhead
+{
+    ReadAheadConfig config;
+    std::vector<std::string> paths;
+    std::vector<uint64_t> sizes;
+
+    std::mutex mutex;
+    std::condition_variable canRead; // signaled when queue has space
+    std::condition_variable canTake; // signaled when a loaded file is added to queue
+    std::deque<ReadAheadFile> loaded;
+    std::vector<ReadAheadFile> freeBuffers;
+    size_t freeBufferBytes = 0;
+    uint32_t nextToRead = 0;
+    uint32_t nextToTake = 0;
+    int queuedFiles = 0;     // files being read or loaded and waiting to be taken
+    uint64_t queuedBytes = 0;
+    bool quit = false;
+
+    std::vector<std::thread> threads;
+
+    void ReaderThread();
+};
+
+static void AllocateBuffer(ReadAheadFile& file, size_t size)
+{
+    if (file.capacity >= size + kJsonPadding)
+        return;
+    delete[] file.data;
+    // round up a bit, so that the buffer has a chance to get reused for other files
+    file.capacity = ((size + kJsonPadding) | 0xFFFF) + 1;
+    file.data = new char[file.capacity];
+}
+
+static bool ReadWholeFile(const std::string& path, ReadAheadFile& file)
+{
+#ifdef _WIN32
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+    fseek(f, 0, SEEK_END);
+    int64_t fsize = ftello64(f);
+    fseek(f, 0, SEEK_SET);
+    if (fsize < 0)
+    {
+        fclose(f);
+        return false;
+    }
+    file.size = size_t(fsize);
+    AllocateBuffer(file, file.size);
+    bool ok = file.size == 0 || fread(file.data, file.size, 1, f) == 1;
+    fclose(f);
+    return ok;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    // we are going to read the whole file sequentially; tell the OS to start
+    // reading it in right away, with aggressive read-ahead
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#elif defined(F_RDAHEAD)
+    fcntl(fd, F_RDAHEAD, 1);
+#endif
+    file.size = size_t(st.st_size);
+    AllocateBuffer(file, file.size);
+    size_t pos = 0;
+    while (pos < file.size)
+    {
+        ssize_t got = read(fd, file.data + pos, file.size - pos);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        pos += size_t(got);
+    }
+    close(fd);
+    return pos == file.size;
+#endif
+}
+
+void ReadAhead::ReaderThread()
+{
+    while (true)
+    {
+        ReadAheadFile file;
+        {
+            // wait until there's space in the queue, and claim the next file to read
+            std::unique_lock<std::mutex> lock(mutex);
+            canRead.wait(lock, [&]()
+            {
+                if (quit || nextToRead >= paths.size())
+                    return true;
+                if (queuedFiles >= config.queueDepth)
+                    return false;
+                // always allow at least one file, even if it's larger than the whole budget
+                return queuedFiles == 0 || queuedBytes + sizes[nextToRead] <= config.byteBudget;
+            });
+            if (quit || nextToRead >= paths.size())
+                return;
+            file.index = nextToRead++;
+            ++queuedFiles;
+            queuedBytes += sizes[file.index];
+
+            // pick a free buffer that is large enough
+            for (size_t i = 0; i < freeBuffers.size(); ++i)
+            {
+                if (freeBuffers[i].capacity >= sizes[file.index] + kJsonPadding)
+                {
+                    file.data = freeBuffers[i].data;
+                    file.capacity = freeBuffers[i].capacity;
+                    freeBufferBytes -= file.capacity;
+                    freeBuffers[i] = freeBuffers.back();
+                    freeBuffers.pop_back();
+                    break;
+                }
+            }
+        }
+
+        file.ok = ReadWholeFile(paths[file.index], file);
+        if (file.data != nullptr)
+            memset(file.data + file.size, 0, kJsonPadding);
+
+        {
+            std::scoped_lock lock(mutex);
+            loaded.emplace_back(file);
+        }
+        canTake.notify_one();
+    }
+}
+
+ReadAhead* CreateReadAhead(const std::vector<std::string>& paths, const std::vector<uint64_t>& sizes, const ReadAheadConfig& config)
+{
+    assert(paths.size() == sizes.size());
+    ReadAhead* ra = new ReadAhead();
+    ra->config = config;
+    ra->config.threads = std::max(ra->config.threads, 1);
+    ra->config.queueDepth = std::max(ra->config.queueDepth, 1);
+    ra->paths = paths;
+    ra->sizes = sizes;
+    for (int i = 0; i < ra->config.threads; ++i)
+        ra->threads.emplace_back(&ReadAhead::ReaderThread, ra);
+    return ra;
+}
+
+void DeleteReadAhead(ReadAhead* ra)
+{
+    {
+        std::scoped_lock lock(ra->mutex);
+        ra->quit = true;
+    }
+    ra->canRead.notify_all();
+    for (auto& t : ra->threads)
+        t.join();
+    for (auto& f : ra->loaded)
+        delete[] f.data;
+    for (auto& f : ra->freeBuffers)
+        delete[] f.data;
+    delete ra;
+}
+
+bool ReadAheadNext(ReadAhead* ra, ReadAheadFile& outFile)
+{
+    {
+        std::unique_lock<std::mutex> lock(ra->mutex);
+        if (ra->nextToTake >= ra->paths.size())
+            return false;
+        ++ra->nextToTake;
+        ra->canTake.wait(lock, [&]() { return !ra->loaded.empty(); });
+        outFile = ra->loaded.front();
+        ra->loaded.pop_front();
+        --ra->queuedFiles;
+        ra->queuedBytes -= ra->sizes[outFile.index];
+    }
+    ra->canRead.notify_all();
+    return true;
+}
+
+void ReadAheadRelease(ReadAhead* ra, ReadAheadFile& file)
+{
+    if (file.data == nullptr)
+        return;
+    {
+        std::scoped_lock lock(ra->mutex);
+        // keep the buffer for reuse, unless we'd keep too much memory around
+        if (ra->freeBufferBytes + file.capacity <= ra->config.byteBudget)
+        {
+            ra->freeBuffers.emplace_back(file);
+            ra->freeBufferBytes += file.capacity;
+            file.data = nullptr;
+        }
+    }
+    delete[] file.data;
+    file.data = nullptr;
+    file.capacity = 0;
+}
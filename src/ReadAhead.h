@@ -0,0 +1,39 @@
+// Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
+// SPDX-License-Identifier: Unlicense
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct ReadAheadConfig
+{
+    int threads = 2;                        // how many reader threads
+    int queueDepth = 32;                    // max. files read ahead and not yet picked up
+    uint64_t byteBudget = 256 * 1024 * 1024; // max. bytes read ahead and not yet picked up
+};
+
+// File contents loaded by ReadAhead. The data is followed by kJsonPadding
+// readable bytes, i.e. it can be passed directly to ParseBuildEvents.
+struct ReadAheadFile
+{
+    uint32_t index = 0; // index into paths passed to CreateReadAhead
+    char* data = nullptr;
+    size_t size = 0;
+    size_t capacity = 0;
+    bool ok = false;
+};
+
+// Pipelined file loading: reader threads load files, in the given order, into
+// memory ahead of whoever is consuming them (e.g. JSON parsing worker threads),
+// so that disk/network I/O latency overlaps with parsing.
+struct ReadAhead;
+// sizes: expected file sizes (e.g. from directory traversal), used for the byte budget.
+ReadAhead* CreateReadAhead(const std::vector<std::string>& paths, const std::vector<uint64_t>& sizes, const ReadAheadConfig& config);
+void DeleteReadAhead(ReadAhead* ra);
+
+// Waits for the next loaded file. Returns false once all the files have been handed out.
+// NOTE: can be called in parallel
+bool ReadAheadNext(ReadAhead* ra, ReadAheadFile& outFile);
+// Gives the file memory back to the read-ahead buffer pool.
+// NOTE: can be called in parallel
+void ReadAheadRelease(ReadAhead* ra, ReadAheadFile& file);
@@ -0,0 +1,320 @@
+// Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
+// SPDX-License-Identifier: Unlicense
+#include "StreamInput.h"
+
+#include "BuildEvents.h"
+#include "Colors.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define read _read
+#define close _close
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct StreamInput
+{
+    std::string path;
+    std::string displayName;
+    int fd = -1;
+    int queueDepth = 1;
+
+    std::mutex mutex;
+    std::condition_variable canRead; // signaled when queue has space
+    std::condition_variable canTake; // signaled when a document is added to queue, or the stream ends
+    std::deque<StreamDocument> loaded;
+    std::vector<StreamDocument> freeDocs;
+    bool finished = false;
+    bool quit = false;
+
+    // read buffer, used by reader thread only
+    std::vector<char> buffer;
+    size_t bufferPos = 0;
+    size_t bufferEnd = 0;
+    bool eof = false;
+    uint64_t docCount = 0;
+
+    std::thread thread;
+
+    void ReaderThread();
+    bool Fill();
+    bool FindNewline(size_t& outPos);
+    bool ReadDocument(StreamDocument& doc);
+};
+
+// Length prefixes larger than this are taken as a corrupt stream.
+const uint64_t kMaxDocumentSize = uint64_t(4) << 30;
+
+static void AllocateDocument(StreamDocument& doc, size_t size)
+{
+    doc.size = size;
+    if (doc.capacity >= size + kJsonPadding)
+        return;
+    delete[] doc.data;
+    doc.capacity = ((size + kJsonPadding) | 0xFFFF) + 1;
+    doc.data = new char[doc.capacity];
+}
+
+static size_t ReadSome(int fd, char* dst, size_t size)
+{
+    while (true)
+    {
+        auto got = read(fd, dst, (unsigned)std::min<size_t>(size, 1 << 30));
+#ifndef _WIN32
+        if (got < 0 && errno == EINTR)
+            continue;
+#endif
+        return got > 0 ? size_t(got) : 0;
+    }
+}
+
+// Reads more data into the buffer; returns false at the end of stream.
+bool StreamInput::Fill()
+{
+    if (eof)
+        return false;
+    if (bufferPos != 0)
+    {
+        memmove(buffer.data(), buffer.data() + bufferPos, bufferEnd - bufferPos);
+        bufferEnd -= bufferPos;
+        bufferPos = 0;
+    }
+    if (bufferEnd == buffer.size())
+        buffer.resize(buffer.size() * 2);
+    size_t got = ReadSome(fd, buffer.data() + bufferEnd, buffer.size() - bufferEnd);
+    if (got == 0)
+    {
+        eof = true;
+        return false;
+    }
+    bufferEnd += got;
+    return true;
+}
+
+// Finds the next newline in the buffer, reading more data as needed. At the end of stream,
+// the end of buffered data counts as newline; returns false if there's no data left at all.
+bool StreamInput::FindNewline(size_t& outPos)
+{
+    size_t scanned = 0; // relative to bufferPos, since Fill moves the data
+    while (true)
+    {
+        size_t from = bufferPos + scanned;
+        const void* nl = memchr(buffer.data() + from, '\n', bufferEnd - from);
+        if (nl != nullptr)
+        {
+            outPos = (const char*)nl - buffer.data();
+            return true;
+        }
+        scanned = bufferEnd - bufferPos;
+        if (!Fill())
+        {
+            outPos = bufferEnd;
+            return bufferEnd > bufferPos;
+        }
+    }
+}
+
+bool StreamInput::ReadDocument(StreamDocument& doc)
+{
+    // skip whitespace between documents
+    while (true)
+    {
+        while (bufferPos < bufferEnd && (buffer[bufferPos] == ' ' || buffer[bufferPos] == '\t' || buffer[bufferPos] == '\r' || buffer[bufferPos] == '\n'))
+            ++bufferPos;
+        if (bufferPos < bufferEnd)
+            break;
+        if (!Fill())
+            return false;
+    }
+
+    ++docCount;
+    doc.name.clear();
+    size_t lineEnd = 0;
+    if (buffer[bufferPos] >= '0' && buffer[bufferPos] <= '9')
+    {
+        // "<length>[ <name>]" line, followed by the document
+        FindNewline(lineEnd);
+        std::string header(buffer.data() + bufferPos, lineEnd - bufferPos);
+        bufferPos = std::min(lineEnd + 1, bufferEnd);
+        char* nameStart = nullptr;
+        uint64_t length = strtoull(header.c_str(), &nameStart, 10);
+        if (nameStart == header.c_str() || (*nameStart != 0 && *nameStart != ' ' && *nameStart != '\t' && *nameStart != '\r') || length > kMaxDocumentSize || length > SIZE_MAX - kJsonPadding)
+        {
+            printf("%sERROR: stream '%s' has an invalid document header '%s'.%s\n", col::kRed, displayName.c_str(), header.substr(0, 64).c_str(), col::kReset);
+            eof = true;
+            bufferPos = bufferEnd;
+            return false;
+        }
+        while (*nameStart == ' ' || *nameStart == '\t')
+            ++nameStart;
+        doc.name = nameStart;
+        while (!doc.name.empty() && (doc.name.back() == '\r' || doc.name.back() == ' '))
+            doc.name.pop_back();
+
+        AllocateDocument(doc, size_t(length));
+        size_t fromBuffer = std::min(length, bufferEnd - bufferPos);
+        memcpy(doc.data, buffer.data() + bufferPos, fromBuffer);
+        bufferPos += fromBuffer;
+        // read the rest directly into the document
+        size_t pos = fromBuffer;
+        while (pos < length)
+        {
+            size_t got = eof ? 0 : ReadSome(fd, doc.data + pos, length - pos);
+            if (got == 0)
+            {
+                eof = true;
+                printf("%sWARN: stream '%s' ended in the middle of a document.%s\n", col::kYellow, displayName.c_str(), col::kReset);
+                doc.size = pos;
+                break;
+            }
+            pos += got;
+        }
+    }
+    else
+    {
+        // single line document
+        FindNewline(lineEnd);
+        AllocateDocument(doc, lineEnd - bufferPos);
+        memcpy(doc.data, buffer.data() + bufferPos, doc.size);
+        bufferPos = std::min(lineEnd + 1, bufferEnd);
+    }
+    memset(doc.data + doc.size, 0, kJsonPadding);
+    if (doc.name.empty())
+        doc.name = displayName + ":" + std::to_string(docCount);
+    return true;
+}
+
+void StreamInput::ReaderThread()
+{
+    if (path != "-")
+    {
+        // for named pipes, this waits until someone opens the pipe for writing
+#ifdef _WIN32
+        fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+#endif
+        if (fd < 0)
+            printf("%sERROR: failed to open '%s'.%s\n", col::kRed, path.c_str(), col::kReset);
+    }
+    buffer.resize(64 * 1024);
+    while (fd >= 0)
+    {
+        StreamDocument doc;
+        {
+            // wait until there's space in the queue
+            std::unique_lock<std::mutex> lock(mutex);
+            canRead.wait(lock, [&]() { return quit || (int)loaded.size() < queueDepth; });
+            if (quit)
+                break;
+            if (!freeDocs.empty())
+            {
+                doc = freeDocs.back();
+                freeDocs.pop_back();
+            }
+        }
+        bool got = ReadDocument(doc);
+        std::scoped_lock lock(mutex);
+        if (!got || quit)
+        {
+            // keep the document memory, so that it's freed with the others
+            freeDocs.emplace_back(doc);
+            break;
+        }
+        loaded.emplace_back(doc);
+        canTake.notify_one();
+    }
+    if (fd >= 0 && path != "-")
+        close(fd);
+
+    std::scoped_lock lock(mutex);
+    finished = true;
+    canTake.notify_all();
+}
+
+StreamInput* CreateStreamInput(const std::string& path, int queueDepth)
+{
+    StreamInput* si = new StreamInput();
+    si->path = path;
+    si->displayName = path == "-" ? "stdin" : path;
+    si->queueDepth = std::max(queueDepth, 1);
+    if (path == "-")
+    {
+#ifdef _WIN32
+        si->fd = _fileno(stdin);
+        _setmode(si->fd, _O_BINARY);
+#else
+        si->fd = STDIN_FILENO;
+#endif
+    }
+    si->thread = std::thread(&StreamInput::ReaderThread, si);
+    return si;
+}
+
+void DeleteStreamInput(StreamInput* si)
+{
+    {
+        std::scoped_lock lock(si->mutex);
+        si->quit = true;
+    }
+    si->canRead.notify_all();
+    si->thread.join();
+    for (auto& d : si->loaded)
+        delete[] d.data;
+    for (auto& d : si->freeDocs)
+        delete[] d.data;
+    delete si;
+}
+
+bool StreamInputNext(StreamInput* si, StreamDocument& outDoc)
+{
+    {
+        std::unique_lock<std::mutex> lock(si->mutex);
+        si->canTake.wait(lock, [&]() { return !si->loaded.empty() || si->finished; });
+        if (si->loaded.empty())
+            return false;
+        outDoc = si->loaded.front();
+        si->loaded.pop_front();
+    }
+    si->canRead.notify_one();
+    return true;
+}
+
+void StreamInputRelease(StreamInput* si, StreamDocument& doc)
+{
+    {
+        std::scoped_lock lock(si->mutex);
+        // keep a few documents around for reuse
+        if ((int)si->freeDocs.size() < si->queueDepth)
+        {
+            si->freeDocs.emplace_back(doc);
+            doc.data = nullptr;
+        }
+    }
+    delete[] doc.data;
+    doc = StreamDocument();
+}
+
+bool IsStreamInput(const std::string& path)
+{
+    if (path == "-")
+        return true;
+#ifdef _WIN32
+    return path.compare(0, 9, "\\\\.\\pipe\\") == 0;
+#else
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+#endif
+}
@@ -0,0 +1,37 @@
+// Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
+// SPDX-License-Identifier: Unlicense
+#pragma once
+#include <stdint.h>
+#include <string>
+
+// Trace document read from a stream. The data is followed by kJsonPadding
+// readable bytes, i.e. it can be passed directly to ParseBuildEvents.
+struct StreamDocument
+{
+    std::string name;
+    char* data = nullptr;
+    size_t size = 0;
+    size_t capacity = 0;
+};
+
+// Reading of trace documents from stdin or a named pipe, as they arrive. The stream
+// contains any number of documents, each of them either:
+// - length prefixed: a "<length>[ <name>]" line, followed by exactly <length> bytes of JSON, or
+// - newline delimited: a single line of JSON.
+// Documents without a name get "<stream>:<number>" names.
+// An invalid length line (or a length over 4GB) is an error, and ends the stream.
+struct StreamInput;
+// path: "-" for stdin, or a named pipe path.
+StreamInput* CreateStreamInput(const std::string& path, int queueDepth);
+void DeleteStreamInput(StreamInput* si);
+
+// Waits for the next document. Returns false once the stream is closed and all documents
+// have been handed out.
+// NOTE: can be called in parallel
+bool StreamInputNext(StreamInput* si, StreamDocument& outDoc);
+// Gives the document memory back for reuse.
+// NOTE: can be called in parallel
+void StreamInputRelease(StreamInput* si, StreamDocument& doc);
+
+// Is the path stdin ("-") or a named pipe, as opposed to an artifacts directory?
+bool IsStreamInput(const std::string& path);
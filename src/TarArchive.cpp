@@ -0,0 +1,225 @@
+// Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
+// SPDX-License-Identifier: Unlicense
+#include "TarArchive.h"
+
+#include "BuildEvents.h"
+#include "Colors.h"
+#include "Utils.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _MSC_VER
+#define fseeko64 _fseeki64
+#elif defined(__APPLE__) || defined(__FreeBSD__) || (defined(__linux__) && !defined(__GLIBC__))
+#define fseeko64 fseeko
+#endif
+
+struct TarArchive
+{
+    std::string path;
+    std::vector<TarMember> members;
+    std::vector<FILE*> threadFiles; // each reading thread gets its own file handle, opened on first use
+};
+
+const size_t kTarBlockSize = 512;
+
+// Numeric header fields are octal text, or base-256 binary when the high bit of the first byte is set (GNU).
+static uint64_t ParseTarNumber(const char* field, size_t len)
+{
+    uint64_t res = 0;
+    if ((uint8_t)field[0] & 0x80)
+    {
+        for (size_t i = 1; i < len; ++i)
+            res = (res << 8) | (uint8_t)field[i];
+        return res;
+    }
+    size_t i = 0;
+    while (i < len && (field[i] == ' ' || field[i] == 0))
+        ++i;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i)
+        res = res * 8 + (field[i] - '0');
+    return res;
+}
+
+static std::string ParseTarString(const char* field, size_t len)
+{
+    return std::string(field, strnlen(field, len));
+}
+
+static bool IsValidTarHeader(const uint8_t* header)
+{
+    // checksum is calculated with the checksum field itself being spaces
+    uint64_t expected = ParseTarNumber((const char*)header + 148, 8);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < kTarBlockSize; ++i)
+        sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    return sum == expected;
+}
+
+// pax extended header records are "<length> <key>=<value>\n"
+static void ParsePaxHeader(const std::string& data, TarMember& member, bool& hasName, bool& hasSize)
+{
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        size_t space = data.find(' ', pos);
+        if (space == std::string::npos)
+            break;
+        uint64_t len = strtoull(data.c_str() + pos, nullptr, 10);
+        if (len == 0 || pos + len > data.size())
+            break;
+        size_t eq = data.find('=', space);
+        if (eq != std::string::npos && eq < pos + len)
+        {
+            std::string key = data.substr(space + 1, eq - space - 1);
+            std::string value = data.substr(eq + 1, pos + len - eq - 2); // without trailing newline
+            if (key == "path")
+            {
+                member.name = value;
+                hasName = true;
+            }
+            else if (key == "size")
+            {
+                member.size = strtoull(value.c_str(), nullptr, 10);
+                hasSize = true;
+            }
+            else if (key == "mtime")
+                member.modTime = strtoll(value.c_str(), nullptr, 10);
+        }
+        pos += len;
+    }
+}
+
+static bool ReadTarHeaders(FILE* f, const std::string& path, std::vector<TarMember>& outMembers)
+{
+    uint8_t header[kTarBlockSize];
+    uint64_t offset = 0;
+    // pending GNU long name / pax header data, applies to the next member
+    TarMember next;
+    bool nextHasName = false, nextHasSize = false;
+    std::string extData;
+    while (true)
+    {
+        if (fread(header, kTarBlockSize, 1, f) != 1)
+            break; // missing end of archive blocks; some tools do not write them
+        offset += kTarBlockSize;
+        bool allZero = true;
+        for (size_t i = 0; i < kTarBlockSize && allZero; ++i)
+            allZero = header[i] == 0;
+        if (allZero)
+            break;
+        if (!IsValidTarHeader(header))
+        {
+            printf("%sERROR: corrupt or unsupported tar archive '%s' (header at offset %llu).%s\n", col::kRed, path.c_str(), (unsigned long long)(offset - kTarBlockSize), col::kReset);
+            return false;
+        }
+
+        const char* h = (const char*)header;
+        char type = h[156];
+        uint64_t size = ParseTarNumber(h + 124, 12);
+        uint64_t dataBlocksSize = (size + kTarBlockSize - 1) / kTarBlockSize * kTarBlockSize;
+        if (type == 'L' || type == 'x')
+        {
+            // GNU long name, or pax extended header for the next member
+            extData.resize(size);
+            if (size != 0 && fread(&extData[0], size, 1, f) != 1)
+                break;
+            if (type == 'L')
+            {
+                next.name = ParseTarString(extData.data(), extData.size());
+                nextHasName = true;
+            }
+            else
+                ParsePaxHeader(extData, next, nextHasName, nextHasSize);
+        }
+        else
+        {
+            if (type == '0' || type == 0 || type == '7')
+            {
+                TarMember member;
+                member.offset = offset;
+                member.size = nextHasSize ? next.size : size;
+                member.modTime = next.modTime != 0 ? next.modTime : (int64_t)ParseTarNumber(h + 136, 12);
+                if (nextHasName)
+                    member.name = next.name;
+                else
+                {
+                    member.name = ParseTarString(h, 100);
+                    std::string prefix = ParseTarString(h + 345, 155);
+                    if (memcmp(h + 257, "ustar\0", 6) == 0 && !prefix.empty()) // POSIX ustar; GNU has other fields there
+                        member.name = prefix + "/" + member.name;
+                }
+                dataBlocksSize = (member.size + kTarBlockSize - 1) / kTarBlockSize * kTarBlockSize;
+                outMembers.emplace_back(member);
+            }
+            next = TarMember();
+            nextHasName = nextHasSize = false;
+            if (fseeko64(f, dataBlocksSize, SEEK_CUR) != 0)
+                break;
+            offset += dataBlocksSize;
+            continue;
+        }
+        if (fseeko64(f, dataBlocksSize - size, SEEK_CUR) != 0)
+            break;
+        offset += dataBlocksSize;
+    }
+    return true;
+}
+
+TarArchive* OpenTarArchive(const std::string& path, uint32_t threadCount)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+    {
+        printf("%sERROR: failed to open tar archive '%s'.%s\n", col::kRed, path.c_str(), col::kReset);
+        return nullptr;
+    }
+    TarArchive* tar = new TarArchive();
+    tar->path = path;
+    bool ok = ReadTarHeaders(f, path, tar->members);
+    fclose(f);
+    if (!ok)
+    {
+        delete tar;
+        return nullptr;
+    }
+    tar->threadFiles.resize(std::max(threadCount, 1u), nullptr);
+    return tar;
+}
+
+void CloseTarArchive(TarArchive* tar)
+{
+    for (FILE* f : tar->threadFiles)
+    {
+        if (f != nullptr)
+            fclose(f);
+    }
+    delete tar;
+}
+
+const std::vector<TarMember>& GetTarMembers(const TarArchive* tar)
+{
+    return tar->members;
+}
+
+bool ReadTarMember(TarArchive* tar, const TarMember& member, std::vector<char>& outData, uint32_t threadIndex)
+{
+    FILE*& f = tar->threadFiles[threadIndex];
+    if (f == nullptr)
+        f = fopen(tar->path.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+    outData.resize(member.size + kJsonPadding);
+    memset(outData.data() + member.size, 0, kJsonPadding);
+    if (fseeko64(f, member.offset, SEEK_SET) != 0)
+        return false;
+    return member.size == 0 || fread(outData.data(), member.size, 1, f) == 1;
+}
+
+bool IsTarArchiveFile(const std::string& path)
+{
+    struct stat st;
+    return utils::EndsWith(path, ".tar") && stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+}
@@ -0,0 +1,32 @@
+// Clang Build Analyzer https://github.com/aras-p/ClangBuildAnalyzer
+// SPDX-License-Identifier: Unlicense
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct TarMember
+{
+    std::string name;
+    uint64_t offset = 0; // offset of member contents in the archive
+    uint64_t size = 0;
+    int64_t modTime = 0;
+};
+
+// Reading of regular file members of a tar archive (POSIX ustar, GNU and pax formats),
+// without extracting it.
+struct TarArchive;
+// threadCount: how many threads will be calling ReadTarMember.
+TarArchive* OpenTarArchive(const std::string& path, uint32_t threadCount);
+void CloseTarArchive(TarArchive* tar);
+
+const std::vector<TarMember>& GetTarMembers(const TarArchive* tar);
+
+// Reads member contents into outData; it is followed by kJsonPadding zero bytes, i.e.
+// it can be passed directly to ParseBuildEvents.
+// NOTE: can be called in parallel, as long as each concurrent call
+// passes a different threadIndex (< threadCount passed at creation).
+bool ReadTarMember(TarArchive* tar, const TarMember& member, std::vector<char>& outData, uint32_t threadIndex);
+
+// Is the path a tar archive file (as opposed to an artifacts directory)?
+bool IsTarArchiveFile(const std::string& path);
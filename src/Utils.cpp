@@ -44,6 +44,36 @@ bool utils::EndsWith(const std::string_view& str, const std::string& suffix)
     return true;
 }
 
+bool utils::GlobMatch(std::string_view pattern, std::string_view str)
+{
+    // iterative matching with backtracking to the last '*'
+    size_t p = 0, s = 0;
+    size_t starP = std::string_view::npos, starS = 0;
+    while (s < str.size())
+    {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == str[s]))
+        {
+            ++p;
+            ++s;
+        }
+        else if (p < pattern.size() && pattern[p] == '*')
+        {
+            starP = p++;
+            starS = s;
+        }
+        else if (starP != std::string_view::npos)
+        {
+            p = starP + 1;
+            s = ++starS;
+        }
+        else
+            return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
+}
+
 
 bool utils::IsHeader(std::string_view path)
 {
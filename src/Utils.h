@@ -15,4 +15,7 @@ namespace utils
 
     [[nodiscard]] bool BeginsWith(const std::string& str, const std::string& prefix);
     [[nodiscard]] bool EndsWith(const std::string_view& str, const std::string& suffix);
+
+    // Simple wildcard match: '*' matches any sequence of characters, '?' matches any one character.
+    [[nodiscard]] bool GlobMatch(std::string_view pattern, std::string_view str);
 }
@@ -8,6 +8,10 @@
 #include "Arena.h"
 #include "BuildEvents.h"
 #include "Colors.h"
+#include "CompileCommands.h"
+#include "ReadAhead.h"
+#include "StreamInput.h"
+#include "TarArchive.h"
 #include "Utils.h"
 
 #include <stdio.h>
@@ -16,6 +20,7 @@
 #include <algorithm>
 #include <set>
 #include <cassert>
+#include <sys/stat.h>
 
 #ifdef _MSC_VER
 struct IUnknown; // workaround for old Win SDK header failures when using /permissive-
@@ -28,6 +33,7 @@ static const char* kVersion = "1.6.0";
 #include "external/sokol_time.h"
 #define CUTE_FILES_IMPLEMENTATION
 #include "external/cute_files.h"
+#include "external/inih/cpp/INIReader.h"
 
 static void ReadFileToString(const std::string& path, std::string& str)
 {
@@ -91,10 +97,24 @@ static void PrintUsage()
     printf("  %s--start <artifactsdir>%s\n", col::kBold, col::kReset);
     printf("  %s--stop <artifactsdir> <filename>%s\n", col::kBold, col::kReset);
     printf("  %s--all <artifactsdir> <filename>%s\n", col::kBold, col::kReset);
+    printf("    (<artifactsdir> can also be a path to compile_commands.json, or to a .tar archive)\n");
+    printf("    (<artifactsdir> can also be '-' for stdin, or a named pipe, to read a stream of trace documents)\n");
     printf("  %s--analyze <filename>%s\n", col::kBold, col::kReset);
     printf("  %s--version%s\n", col::kBold, col::kReset);
 }
 
+// session file is in the artifacts directory, or next to the compilation database / archive
+static std::string GetSessionFilePath(const std::string& artifactsDir)
+{
+    std::string dir = artifactsDir;
+    if (IsCompileCommandsFile(artifactsDir) || IsTarArchiveFile(artifactsDir))
+    {
+        size_t slash = dir.find_last_of("/\\");
+        dir = slash == std::string::npos ? "." : dir.substr(0, slash);
+    }
+    return dir + "/ClangBuildAnalyzerSession.txt";
+}
+
 static int RunStart(int argc, const char* argv[])
 {
     if (argc < 3)
@@ -104,7 +124,7 @@ static int RunStart(int argc, const char* argv[])
     }
 
     std::string artifactsDir = argv[2];
-    std::string fname = artifactsDir+"/ClangBuildAnalyzerSession.txt";
+    std::string fname = GetSessionFilePath(artifactsDir);
     FILE* fsession = fopen(fname.c_str(), "wt");
     if (!fsession)
     {
@@ -127,6 +147,67 @@ static int RunStart(int argc, const char* argv[])
     return 0;
 }
 
+static void SplitList(const std::string& str, std::vector<std::string>& out)
+{
+    size_t start = 0;
+    while (start < str.size())
+    {
+        size_t end = str.find_first_of(",;", start);
+        if (end == std::string::npos)
+            end = str.size();
+        std::string item = str.substr(start, end - start);
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (!item.empty())
+            out.emplace_back(item);
+        start = end + 1;
+    }
+}
+
+struct IngestConfig
+{
+    int readThreads = 0;
+    int readAheadFiles = 32;
+    int readAheadMB = 256;
+    std::vector<std::string> pruneDirs;
+    bool cache = false;
+    int splitFileMB = 64;
+    bool compactDataFile = false;
+    BuildEventsPruning pruning;
+};
+
+// tests always parse all the files
+static bool s_DisableIngestCache = false;
+// tests can have their own config file
+static std::string s_ConfigFile = "ClangBuildAnalyzer.ini";
+
+static IngestConfig ReadIngestConfig()
+{
+    IngestConfig config;
+    INIReader ini(s_ConfigFile);
+
+    config.readThreads      = (int)ini.GetInteger("ingest", "readThreads",    config.readThreads);
+    config.readAheadFiles   = (int)ini.GetInteger("ingest", "readAheadFiles", config.readAheadFiles);
+    config.readAheadMB      = (int)ini.GetInteger("ingest", "readAheadMB",    config.readAheadMB);
+    SplitList(ini.Get("ingest", "pruneDirs", ""), config.pruneDirs);
+    config.splitFileMB      = (int)ini.GetInteger("ingest", "splitFileMB",    config.splitFileMB);
+    config.cache            = ini.GetBoolean("ingest", "cache",           config.cache) && !s_DisableIngestCache;
+    config.compactDataFile  = ini.GetBoolean("ingest", "compactDataFile", config.compactDataFile);
+
+    int64_t* minUs = config.pruning.minDurationUs;
+    minUs[int(BuildEventType::kParseFile)]           = ini.GetInteger("ingest", "minParseFileUs",           0);
+    minUs[int(BuildEventType::kParseTemplate)]       = ini.GetInteger("ingest", "minParseTemplateUs",       0);
+    minUs[int(BuildEventType::kParseClass)]          = ini.GetInteger("ingest", "minParseClassUs",          0);
+    minUs[int(BuildEventType::kInstantiateClass)]    = ini.GetInteger("ingest", "minInstantiateClassUs",    0);
+    minUs[int(BuildEventType::kInstantiateFunction)] = ini.GetInteger("ingest", "minInstantiateFunctionUs", 0);
+    minUs[int(BuildEventType::kOptFunction)]         = ini.GetInteger("ingest", "minOptFunctionUs",         0);
+    SplitList(ini.Get("ingest", "includeUnits", ""), config.pruning.includeUnits);
+    SplitList(ini.Get("ingest", "excludeUnits", ""), config.pruning.excludeUnits);
+    SplitList(ini.Get("ingest", "includeHeaders", ""), config.pruning.includeHeaders);
+    SplitList(ini.Get("ingest", "excludeHeaders", ""), config.pruning.excludeHeaders);
+    return config;
+}
+
 #ifdef WIN32
 static time_t FiletimeToTime(const FILETIME& ft)
 {
@@ -137,6 +218,15 @@ static time_t FiletimeToTime(const FILETIME& ft)
 }
 #endif
 
+struct JsonFile
+{
+    std::string path;
+    uint64_t size = 0;
+    int64_t modTime = 0;
+    int tarMember = -1; // index of tar archive member, when reading from an archive
+    bool operator<(const JsonFile& rhs) const { return path < rhs.path; }
+};
+
 struct JsonFileFinder
 {
     JsonFileFinder()
@@ -145,75 +235,409 @@ struct JsonFileFinder
 
     time_t startTime;
     time_t endTime;
-    std::vector<std::string> files;
+    std::vector<std::string> pruneDirs;
+    std::vector<JsonFile> files;
+    std::vector<std::string> staleSources; // compilation database entries without a trace file
+    // listed directories (with trailing slash), and the object files in them
+    std::vector<std::pair<std::string, std::vector<std::string>>> objectFileDirs;
+
+    // Walks the directory tree in parallel, one directory tree level at a time:
+    // directories of each level are split across scheduler threads.
+    void Find(enki::TaskScheduler& ts, const std::string& rootDir)
+    {
+        std::vector<std::string> level;
+        level.emplace_back(rootDir);
+        std::vector<std::vector<std::string>> threadDirs(ts.GetNumTaskThreads());
+        std::vector<std::vector<JsonFile>> threadFiles(ts.GetNumTaskThreads());
+        std::vector<std::vector<std::pair<std::string, std::vector<std::string>>>> threadObjectFileDirs(ts.GetNumTaskThreads());
+        while (!level.empty())
+        {
+            enki::TaskSet task((uint32_t)level.size(), [&](enki::TaskSetPartition range, uint32_t threadnum)
+            {
+                for (auto idx = range.start; idx < range.end; ++idx)
+                    ReadDir(level[idx], threadDirs[threadnum], threadFiles[threadnum], threadObjectFileDirs[threadnum]);
+            });
+            ts.AddTaskSetToPipe(&task);
+            ts.WaitforTask(&task);
+
+            level.clear();
+            for (auto& dirs : threadDirs)
+            {
+                std::move(dirs.begin(), dirs.end(), std::back_inserter(level));
+                dirs.clear();
+            }
+        }
+        for (auto& f : threadFiles)
+            std::move(f.begin(), f.end(), std::back_inserter(files));
+        for (auto& d : threadObjectFileDirs)
+            std::move(d.begin(), d.end(), std::back_inserter(objectFileDirs));
+    }
 
-    void OnFile(cf_file_t* f)
+    // Instead of walking a directory, checks the trace files that a compilation database
+    // says should exist. Ones that are missing, or not from this session, are stale.
+    void FindFromCompileCommands(enki::TaskScheduler& ts, const std::vector<CompileCommandTrace>& traces)
     {
-        // extension has to be json
-        const char* ext = cf_get_ext(f);
-        if (ext == NULL || strcmp(ext, ".json") != 0)
-            return;
+        std::vector<JsonFile> found(traces.size());
+        enki::TaskSet task((uint32_t)traces.size(), [&](enki::TaskSetPartition range, uint32_t)
+        {
+            for (auto idx = range.start; idx < range.end; ++idx)
+            {
+                struct stat st;
+                if (stat(traces[idx].tracePath.c_str(), &st) == 0 && st.st_mtime >= startTime && st.st_mtime <= endTime)
+                {
+                    found[idx].path = traces[idx].tracePath;
+                    found[idx].size = st.st_size;
+                    found[idx].modTime = st.st_mtime;
+                }
+            }
+        });
+        ts.AddTaskSetToPipe(&task);
+        ts.WaitforTask(&task);
 
-        // modification time between our session start & end
-        cf_time_t mtime;
-        if (!cf_get_file_time(f->path, &mtime))
-            return;
-        time_t fileModTime;
-#ifdef WIN32
-        fileModTime = FiletimeToTime(mtime.time);
-#else
-        fileModTime = mtime.time;
-#endif
+        for (size_t i = 0; i < traces.size(); ++i)
+        {
+            if (!found[i].path.empty())
+                files.emplace_back(std::move(found[i]));
+            else
+                staleSources.emplace_back(traces[i].sourceFile);
+        }
+    }
 
-        if (fileModTime < startTime || fileModTime > endTime)
-            return;
+    // Instead of walking a directory, takes just one trace file; returns false if the
+    // path is not a .json file.
+    bool FindSingleFile(const std::string& path)
+    {
+        struct stat st;
+        if (!HasJsonExtension(utils::GetFilename(path).data()) || stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+            return false;
+        if (st.st_mtime >= startTime && st.st_mtime <= endTime)
+        {
+            JsonFile file;
+            file.path = path;
+            std::replace(file.path.begin(), file.path.end(), '\\', '/');
+            file.size = st.st_size;
+            file.modTime = st.st_mtime;
+            files.emplace_back(file);
+        }
+        return true;
+    }
 
-        std::string path = f->path;
-        std::replace(path.begin(), path.end(), '\\', '/'); // replace path to forward slashes
-        files.emplace_back(path);
+    // Instead of walking a directory, finds .json members of a tar archive.
+    void FindInTarArchive(const TarArchive* tar)
+    {
+        const std::vector<TarMember>& members = GetTarMembers(tar);
+        for (size_t i = 0; i < members.size(); ++i)
+        {
+            const TarMember& member = members[i];
+            if (!HasJsonExtension(utils::GetFilename(member.name).data()) || member.modTime < startTime || member.modTime > endTime)
+                continue;
+            JsonFile file;
+            file.path = member.name;
+            if (file.path.compare(0, 2, "./") == 0)
+                file.path.erase(0, 2);
+            file.size = member.size;
+            file.modTime = member.modTime;
+            file.tarMember = int(i);
+            files.emplace_back(file);
+        }
+    }
+
+private:
+    bool IsPruned(const char* name) const
+    {
+        // skip hidden directories, and ones that match the prune patterns
+        if (name[0] == '.')
+            return true;
+        for (const auto& pattern : pruneDirs)
+            if (utils::GlobMatch(pattern, name))
+                return true;
+        return false;
     }
 
-    static void Callback(cf_file_t* f, void* userData)
+    static bool HasJsonExtension(const char* name)
     {
-        JsonFileFinder* self = (JsonFileFinder*)userData;
-        self->OnFile(f);
+        const char* ext = strrchr(name, '.');
+        return ext != NULL && ext != name && strcmp(ext, ".json") == 0;
+    }
+
+    void ReadDir(const std::string& dirPath, std::vector<std::string>& outDirs, std::vector<JsonFile>& outFiles, std::vector<std::pair<std::string, std::vector<std::string>>>& outObjectFileDirs) const
+    {
+        cf_dir_t dir;
+        if (!cf_dir_open(&dir, dirPath.c_str()))
+            return;
+        // remember object files too, so that trace files can be matched with them later
+        // without checking the file system again
+        std::string objectDir = dirPath + "/";
+        std::replace(objectDir.begin(), objectDir.end(), '\\', '/');
+        std::vector<std::string> objectFiles;
+        std::string path;
+        while (dir.has_next)
+        {
+            // use information that comes with the directory entry itself, and only
+            // do a stat() when that is not enough
+#ifdef WIN32
+            const WIN32_FIND_DATAA& entry = dir.fdata;
+            const char* name = entry.cFileName;
+            bool isDir = (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            bool isJson = !isDir && HasJsonExtension(name);
+#else
+            const char* name = dir.entry->d_name;
+#if defined(DT_DIR)
+            bool needStat = dir.entry->d_type == DT_LNK || dir.entry->d_type == DT_UNKNOWN;
+            bool isDir = dir.entry->d_type == DT_DIR;
+            bool isJson = dir.entry->d_type == DT_REG && HasJsonExtension(name);
+#else
+            bool needStat = true;
+            bool isDir = false;
+            bool isJson = false;
+#endif
+            struct stat st;
+            if (needStat || isJson)
+            {
+                path = dirPath + "/" + name;
+                if (stat(path.c_str(), &st) != 0)
+                {
+                    cf_dir_next(&dir);
+                    continue;
+                }
+                isDir = S_ISDIR(st.st_mode);
+                isJson = S_ISREG(st.st_mode) && HasJsonExtension(name);
+            }
+#endif
+            if (utils::EndsWith(name, ".o") || utils::EndsWith(name, ".obj"))
+                objectFiles.emplace_back(name);
+            if (isDir)
+            {
+                if (!IsPruned(name))
+                    outDirs.emplace_back(dirPath + "/" + name);
+            }
+            else if (isJson)
+            {
+                // modification time between our session start & end
+#ifdef WIN32
+                time_t fileModTime = FiletimeToTime(entry.ftLastWriteTime);
+                uint64_t fileSize = (uint64_t(entry.nFileSizeHigh) << 32) | entry.nFileSizeLow;
+#else
+                time_t fileModTime = st.st_mtime;
+                uint64_t fileSize = st.st_size;
+#endif
+                if (fileModTime >= startTime && fileModTime <= endTime)
+                {
+                    JsonFile file;
+                    file.path = dirPath + "/" + name;
+                    std::replace(file.path.begin(), file.path.end(), '\\', '/'); // replace path to forward slashes
+                    file.size = fileSize;
+                    file.modTime = fileModTime;
+                    outFiles.emplace_back(file);
+                }
+            }
+            cf_dir_next(&dir);
+        }
+        cf_dir_close(&dir);
+        outObjectFileDirs.emplace_back(std::move(objectDir), std::move(objectFiles));
     }
 };
 
+// Merges the parsed events of all files (in parallel) and writes them into the data file.
+static bool MergeAndSaveBuildEvents(enki::TaskScheduler& ts, BuildEventsParser* parser, const std::string& outFile, bool compact)
+{
+    enki::TaskSet task(BeginMergeBuildEvents(parser), [&](enki::TaskSetPartition range, uint32_t)
+    {
+        for (auto i = range.start; i < range.end; ++i)
+            MergeBuildEventsFile(parser, i);
+    });
+    ts.AddTaskSetToPipe(&task);
+    ts.WaitforTask(&task);
+    return SaveBuildEvents(parser, outFile, compact);
+}
+
 static int ProcessJsonFiles(const std::string& artifactsDir, const std::string& outFile, time_t startTime, time_t stopTime) {
     uint64_t tStart = stm_now();
+    IngestConfig config = ReadIngestConfig();
+    enki::TaskScheduler ts;
+    ts.Initialize(std::max(std::thread::hardware_concurrency(), 1u));
 
    // find .json files with modification times in our interval
     JsonFileFinder jsonFiles;
     jsonFiles.startTime = startTime;
     jsonFiles.endTime = stopTime;
-    cf_traverse(artifactsDir.c_str(), JsonFileFinder::Callback, &jsonFiles);
+    jsonFiles.pruneDirs = config.pruneDirs;
+    TarArchive* tar = nullptr;
+    if (IsTarArchiveFile(artifactsDir))
+    {
+        // parse .json members straight from the archive, without extracting it
+        tar = OpenTarArchive(artifactsDir, ts.GetNumTaskThreads());
+        if (tar == nullptr)
+            return 1;
+        jsonFiles.FindInTarArchive(tar);
+    }
+    else if (IsCompileCommandsFile(artifactsDir))
+    {
+        // only look at the trace files of the compilation database entries
+        std::vector<CompileCommandTrace> traces;
+        if (!ReadCompileCommands(artifactsDir, traces))
+            return 1;
+        std::sort(traces.begin(), traces.end(), [](const CompileCommandTrace& a, const CompileCommandTrace& b) { return a.tracePath < b.tracePath; });
+        traces.erase(std::unique(traces.begin(), traces.end(), [](const CompileCommandTrace& a, const CompileCommandTrace& b) { return a.tracePath == b.tracePath; }), traces.end());
+        jsonFiles.FindFromCompileCommands(ts, traces);
+        if (!jsonFiles.staleSources.empty())
+        {
+            const size_t kMaxListed = 10;
+            printf("%sWARN: %zu of %zu compilation database entries have no trace file from this build (stale):%s\n", col::kYellow, jsonFiles.staleSources.size(), traces.size(), col::kReset);
+            for (size_t i = 0; i < jsonFiles.staleSources.size() && i < kMaxListed; ++i)
+                printf("  %s\n", jsonFiles.staleSources[i].c_str());
+            if (jsonFiles.staleSources.size() > kMaxListed)
+                printf("  ...and %zu more\n", jsonFiles.staleSources.size() - kMaxListed);
+        }
+    }
+    else if (!jsonFiles.FindSingleFile(artifactsDir))
+        jsonFiles.Find(ts, artifactsDir);
     if (jsonFiles.files.empty())
     {
         printf("%sERROR: no .json files found under '%s'.%s\n", col::kRed, artifactsDir.c_str(), col::kReset);
+        if (tar != nullptr)
+            CloseTarArchive(tar);
         return 1;
     }
     // sort input filenames so that runs are deterministic on different file systems
     // with the same input data
     std::sort(jsonFiles.files.begin(), jsonFiles.files.end());
 
+    BuildEventsParser* parser = CreateBuildEventsParser(ts.GetNumTaskThreads());
+    SetBuildEventsPruning(parser, config.pruning);
+    for (auto& d : jsonFiles.objectFileDirs)
+        AddKnownObjectFiles(parser, d.first, d.second);
+
+    // files that did not change since the previous run are taken from the ingest cache
+    // without parsing; they are put before the files that need parsing
+    std::string cacheFile = outFile + ".cache";
+    if (config.cache)
+        LoadBuildEventsCache(parser, cacheFile);
+    std::vector<uint32_t> cachedFiles;
+    std::vector<uint32_t> parseOrder;
+    for (size_t i = 0; i < jsonFiles.files.size(); ++i)
+    {
+        const JsonFile& file = jsonFiles.files[i];
+        if (config.cache && IsBuildEventsFileCached(parser, file.path, file.size, file.modTime))
+            cachedFiles.emplace_back(uint32_t(i));
+        else
+            parseOrder.emplace_back(uint32_t(i));
+    }
+
+    // parse the largest files first: files are handed out one by one in order of
+    // decreasing size to whichever thread asks for more work, so that the run does
+    // not end up waiting on a thread that got several huge files at the end
+    std::stable_sort(parseOrder.begin(), parseOrder.end(), [&](uint32_t a, uint32_t b)
+    {
+        return jsonFiles.files[a].size > jsonFiles.files[b].size;
+    });
+
+    // very large files are parsed one at a time before the others, each split into chunks
+    // that are parsed by all the threads
+    std::vector<uint32_t> splitFiles;
+    if (config.splitFileMB > 0 && ts.GetNumTaskThreads() > 1 && tar == nullptr)
+    {
+        const uint64_t splitSize = uint64_t(config.splitFileMB) * 1024 * 1024;
+        while (splitFiles.size() < parseOrder.size() && jsonFiles.files[parseOrder[splitFiles.size()]].size >= splitSize)
+            splitFiles.emplace_back(parseOrder[splitFiles.size()]);
+        parseOrder.erase(parseOrder.begin(), parseOrder.begin() + splitFiles.size());
+    }
+
+    // optionally, dedicated reader threads load the files (in the same order)
+    // ahead of the parsing threads, to overlap file I/O with parsing
+    ReadAhead* readAhead = nullptr;
+    if (config.readThreads > 0 && !parseOrder.empty() && tar == nullptr)
+    {
+        std::vector<std::string> paths;
+        std::vector<uint64_t> sizes;
+        paths.reserve(parseOrder.size());
+        sizes.reserve(parseOrder.size());
+        for (uint32_t idx : parseOrder)
+        {
+            paths.emplace_back(jsonFiles.files[idx].path);
+            sizes.emplace_back(jsonFiles.files[idx].size);
+        }
+        ReadAheadConfig raConfig;
+        raConfig.threads = config.readThreads;
+        raConfig.queueDepth = config.readAheadFiles;
+        raConfig.byteBudget = uint64_t(std::max(config.readAheadMB, 1)) * 1024 * 1024;
+        readAhead = CreateReadAhead(paths, sizes, raConfig);
+    }
+
     // parse the json files into our data structures (in parallel)
-    BuildEventsParser* parser = CreateBuildEventsParser();
     std::atomic<int> fileCount(0);
+    for (uint32_t idx : splitFiles)
     {
-        enki::TaskScheduler ts;
-        ts.Initialize(std::min(std::thread::hardware_concurrency(), (uint32_t)jsonFiles.files.size()));
-        enki::TaskSet task((uint32_t)jsonFiles.files.size(), [&](enki::TaskSetPartition range, uint32_t threadnum)
+        const JsonFile& file = jsonFiles.files[idx];
+        BuildEventsSplit* split = BeginSplitBuildEvents(parser, file.path, file.modTime, ts.GetNumTaskThreads() * 4);
+        enki::TaskSet task(GetSplitBuildEventsChunkCount(split), [&](enki::TaskSetPartition range, uint32_t threadnum)
         {
-            for (auto idx = range.start; idx < range.end; ++idx)
+            for (auto i = range.start; i < range.end; ++i)
+                ParseSplitBuildEventsChunk(split, i, threadnum);
+        });
+        ts.AddTaskSetToPipe(&task);
+        ts.WaitforTask(&task);
+        if (EndSplitBuildEvents(split))
+            fileCount++;
+    }
+    {
+        // each executed range element takes the next cached file, or the next largest
+        // file that is not parsed yet, no matter which partition of the task set it is in
+        std::atomic<uint32_t> nextCached(0);
+        std::atomic<uint32_t> nextFile(0);
+        std::vector<std::vector<char>> tarBuffers(tar != nullptr ? ts.GetNumTaskThreads() : 0);
+        enki::TaskSet task(uint32_t(cachedFiles.size() + parseOrder.size()), [&](enki::TaskSetPartition range, uint32_t threadnum)
+        {
+            for (auto i = range.start; i < range.end; ++i)
             {
-                if (ParseBuildEvents(parser, jsonFiles.files[idx]))
+                uint32_t cachedIndex = nextCached++;
+                if (cachedIndex < cachedFiles.size())
+                {
+                    const JsonFile& file = jsonFiles.files[cachedFiles[cachedIndex]];
+                    if (ParseCachedBuildEvents(parser, file.path, file.size, file.modTime))
+                        fileCount++;
+                    continue;
+                }
+                if (readAhead != nullptr)
+                {
+                    ReadAheadFile loaded;
+                    if (!ReadAheadNext(readAhead, loaded))
+                        break;
+                    const JsonFile& file = jsonFiles.files[parseOrder[loaded.index]];
+                    if (!loaded.ok)
+                        printf("%sWARN: failed to read %s.%s\n", col::kYellow, file.path.c_str(), col::kReset);
+                    else if (ParseBuildEvents(parser, file.path, file.modTime, loaded.data, loaded.size, threadnum))
+                        fileCount++;
+                    ReadAheadRelease(readAhead, loaded);
+                    continue;
+                }
+                const JsonFile& file = jsonFiles.files[parseOrder[nextFile++]];
+                if (tar != nullptr)
+                {
+                    std::vector<char>& buffer = tarBuffers[threadnum];
+                    if (!ReadTarMember(tar, GetTarMembers(tar)[file.tarMember], buffer, threadnum))
+                        printf("%sWARN: failed to read %s from '%s'.%s\n", col::kYellow, file.path.c_str(), artifactsDir.c_str(), col::kReset);
+                    else if (ParseBuildEvents(parser, file.path, file.modTime, buffer.data(), file.size, threadnum))
+                        fileCount++;
+                    continue;
+                }
+                if (ParseBuildEvents(parser, file.path, file.modTime, threadnum))
                     fileCount++;
             }
         });
         ts.AddTaskSetToPipe(&task);
         ts.WaitforTask(&task);
     }
+    if (readAhead != nullptr)
+        DeleteReadAhead(readAhead);
+    if (tar != nullptr)
+        CloseTarArchive(tar);
+    if (config.cache)
+    {
+        SaveBuildEventsCache(parser, cacheFile);
+        if (!cachedFiles.empty())
+            printf("%s  %zu of %zu files did not change, taken from ingest cache '%s'.%s\n", col::kYellow, cachedFiles.size(), jsonFiles.files.size(), cacheFile.c_str(), col::kReset);
+    }
     if (fileCount == 0)
     {
         printf("%sERROR: no clang -ftime-trace .json files found under '%s'.%s\n", col::kRed, artifactsDir.c_str(), col::kReset);
@@ -221,7 +645,7 @@ static int ProcessJsonFiles(const std::string& artifactsDir, const std::string&
     }
 
     // create the data file
-    if (!SaveBuildEvents(parser, outFile))
+    if (!MergeAndSaveBuildEvents(ts, parser, outFile, config.compactDataFile))
         return 1;
 
     DeleteBuildEventsParser(parser);
@@ -233,6 +657,54 @@ static int ProcessJsonFiles(const std::string& artifactsDir, const std::string&
     return 0;
 }
 
+// Parses trace documents as they arrive on stdin or a named pipe, and writes the data file
+// once the stream is closed.
+static int ProcessStream(const std::string& source, const std::string& outFile)
+{
+    uint64_t tStart = stm_now();
+    IngestConfig config = ReadIngestConfig();
+    enki::TaskScheduler ts;
+    ts.Initialize(std::max(std::thread::hardware_concurrency(), 1u));
+
+    BuildEventsParser* parser = CreateBuildEventsParser(ts.GetNumTaskThreads());
+    SetBuildEventsPruning(parser, config.pruning);
+    StreamInput* stream = CreateStreamInput(source, std::max(config.readAheadFiles, (int)ts.GetNumTaskThreads()));
+
+    // each thread keeps taking documents until the stream ends
+    std::atomic<int> fileCount(0);
+    enki::TaskSet task(ts.GetNumTaskThreads(), [&](enki::TaskSetPartition, uint32_t threadnum)
+    {
+        StreamDocument doc;
+        while (StreamInputNext(stream, doc))
+        {
+            if (ParseBuildEvents(parser, doc.name, 0, doc.data, doc.size, threadnum))
+                fileCount++;
+            StreamInputRelease(stream, doc);
+        }
+    });
+    ts.AddTaskSetToPipe(&task);
+    ts.WaitforTask(&task);
+    DeleteStreamInput(stream);
+
+    if (fileCount == 0)
+    {
+        printf("%sERROR: no clang -ftime-trace documents found in '%s'.%s\n", col::kRed, source == "-" ? "stdin" : source.c_str(), col::kReset);
+        DeleteBuildEventsParser(parser);
+        return 1;
+    }
+
+    // create the data file
+    if (!MergeAndSaveBuildEvents(ts, parser, outFile, config.compactDataFile))
+        return 1;
+
+    DeleteBuildEventsParser(parser);
+
+    double tDuration = stm_sec(stm_since(tStart));
+    printf("%s  done in %.1fs. Run 'ClangBuildAnalyzer --analyze %s' to analyze it.%s\n", col::kYellow, tDuration, outFile.c_str(), col::kReset);
+
+    return 0;
+}
+
 static int RunStop(int argc, const char* argv[])
 {
     if (argc < 4)
@@ -245,7 +717,9 @@ static int RunStop(int argc, const char* argv[])
     printf("%sStopping build tracing and saving to '%s'...%s\n", col::kYellow, outFile.c_str(), col::kReset);
 
     std::string artifactsDir = argv[2];
-    std::string fname = artifactsDir+"/ClangBuildAnalyzerSession.txt";
+    if (IsStreamInput(artifactsDir))
+        return ProcessStream(artifactsDir, outFile);
+    std::string fname = GetSessionFilePath(artifactsDir);
     FILE* fsession = fopen(fname.c_str(), "rt");
     if (!fsession)
     {
@@ -277,6 +751,8 @@ static int RunAll(int argc, const char* argv[])
     printf("%sProcessing all files and saving to '%s'...%s\n", col::kYellow, outFile.c_str(), col::kReset);
 
     std::string artifactsDir = argv[2];
+    if (IsStreamInput(artifactsDir))
+        return ProcessStream(artifactsDir, outFile);
 
     return ProcessJsonFiles(artifactsDir, outFile, 0, std::numeric_limits<time_t>::max());
 }
@@ -294,18 +770,20 @@ static int RunAnalyze(int argc, const char* argv[], FILE* out)
     std::string inFile = argv[2];
     printf("%sAnalyzing build trace from '%s'...%s\n", col::kYellow, inFile.c_str(), col::kReset);
 
+    enki::TaskScheduler ts;
+    ts.Initialize(std::max(std::thread::hardware_concurrency(), 1u));
+
     // load data dump file
-    BuildEvents events;
-    BuildNames names;
-    if (!LoadBuildEvents(inFile, events, names))
+    BuildEventsFile file;
+    if (!LoadBuildEvents(ts, inFile, file))
         return 1;
-    if (events.empty())
+    if (file.eventsCount == 0)
     {
         printf("%s  no trace events found.%s\n", col::kYellow, col::kReset);
         return 1;
     }
 
-    DoAnalysis(events, names, out);
+    DoAnalysis(ts, file.events, file.eventsCount, file.names, out, s_ConfigFile);
 
     double tDuration = stm_sec(stm_since(tStart));
     printf("%s  done in %.1fs.%s\n", col::kYellow, tDuration, col::kReset);
@@ -313,19 +791,57 @@ static int RunAnalyze(int argc, const char* argv[], FILE* out)
     return 0;
 }
 
+// Runs --stop and --analyze on a test folder, and compares the analysis output with the
+// expected one. If the folder has a ClangBuildAnalyzer.ini file, it is used instead of
+// the one in the working directory; "input" in its [test] section is then a file in the
+// folder (e.g. a compilation database) that is passed to --all instead, and "stdin" is a
+// file in the folder that is read as trace stream from stdin.
 static int RunOneTest(const std::string& folder)
 {
     printf("%sRunning test '%s'...%s\n", col::kYellow, folder.c_str(), col::kReset);
     std::string traceFile = folder + "/_TraceOutput.bin";
-    const char* kStopArgs[] =
+    std::string configFile = folder + "/ClangBuildAnalyzer.ini";
+    struct stat st;
+    s_ConfigFile = stat(configFile.c_str(), &st) == 0 ? configFile : "ClangBuildAnalyzer.ini";
+    INIReader ini(s_ConfigFile);
+    std::string input = ini.Get("test", "input", "");
+    std::string stdinFile = ini.Get("test", "stdin", "");
+    if (!stdinFile.empty())
     {
-        "",
-        "--stop",
-        folder.c_str(),
-        traceFile.c_str()
-    };
-    if (RunStop(4, kStopArgs) != 0)
-        return false;
+        stdinFile = folder + "/" + stdinFile;
+        if (freopen(stdinFile.c_str(), "rb", stdin) == nullptr)
+        {
+            printf("%sFailed to open test input file '%s'%s\n", col::kRed, stdinFile.c_str(), col::kReset);
+            return false;
+        }
+        input = "-";
+    }
+    else if (!input.empty())
+        input = folder + "/" + input;
+    if (!input.empty())
+    {
+        const char* kAllArgs[] =
+        {
+            "",
+            "--all",
+            input.c_str(),
+            traceFile.c_str()
+        };
+        if (RunAll(4, kAllArgs) != 0)
+            return false;
+    }
+    else
+    {
+        const char* kStopArgs[] =
+        {
+            "",
+            "--stop",
+            folder.c_str(),
+            traceFile.c_str()
+        };
+        if (RunStop(4, kStopArgs) != 0)
+            return false;
+    }
 
     std::string analyzeFile = folder + "/_AnalysisOutput.txt";
     std::string analyzeExpFile = folder + "/_AnalysisOutputExpected.txt";
@@ -371,6 +887,7 @@ static int RunTests(int argc, const char* argv[])
     }
 
     uint64_t tStart = stm_now();
+    s_DisableIngestCache = true;
 
     std::string testsFolder = argv[2];
     printf("%sRunning tests under '%s'...%s\n", col::kYellow, testsFolder.c_str(), col::kReset);